@@ -0,0 +1,1310 @@
+// Benchmark executable: History.cpp + Showcase.cpp (with HISTORY_SHOWCASE_NO_MAIN) + Benchmark.cpp.
+// Usage: Benchmark [operation count, default 1000000]
+//        Benchmark stress [runs, default 1000] [operations per run, default 200] [seed, default 1]
+//        Benchmark scale [max records, default 1000000000] [memory budget in GB, default 16]
+// Prints one JSON object per line, so runs of different library versions can be diffed / plotted.
+// Built with HISTORY_ALLOCATION_TRACKING=1 (plus HistoryAllocations.cpp), it also fails with exit code 1
+// if a warmed-up push / Undo / Redo cycle allocates inside History.
+
+#include "History.h"
+#include "HistoryAllocations.h"
+#include "HistoryLinear.h"
+#include "HistoryLog.h"
+#include "HistoryPersistent.h"
+#include "HistoryVariant.h"
+#include "Showcase.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using BenchClock = std::chrono::steady_clock;
+
+static double SecondsSince(BenchClock::time_point start)
+{
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static double NanosecondsSince(BenchClock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+// Peak resident memory of the process so far.
+static double PeakMemoryKB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return double(counters.PeakWorkingSetSize) / 1024.0;
+#else
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return double(usage.ru_maxrss) / 1024.0;
+#else
+    return double(usage.ru_maxrss);
+#endif
+#endif
+}
+
+// Resident memory of the process now. Falls back to the peak where the platform doesn't tell.
+static double CurrentMemoryKB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return double(counters.WorkingSetSize) / 1024.0;
+#elif defined(__linux__)
+    long pages = 0;
+    long resident = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r"))
+    {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        std::fclose(statm);
+    }
+
+    return resident ? double(resident) * double(sysconf(_SC_PAGESIZE)) / 1024.0 : PeakMemoryKB();
+#else
+    return PeakMemoryKB();
+#endif
+}
+
+// Prints {"bench":..., "manager":..., <values>..., "peak_kb":...}
+static void Report(const char* bench, const char* manager, std::initializer_list<std::pair<const char*, double>> values)
+{
+    std::printf("{\"bench\":\"%s\",\"manager\":\"%s\"", bench, manager);
+    for (auto&& [name, value] : values)
+        std::printf(",\"%s\":%.6g", name, value);
+
+    std::printf(",\"peak_kb\":%.0f}\n", PeakMemoryKB());
+    std::fflush(stdout);
+}
+
+struct LatencyStats
+{
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+static LatencyStats Summarize(std::vector<double>& samples)
+{
+    LatencyStats stats;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double q) { return samples[std::min(samples.size() - 1, size_t(q * double(samples.size())))]; };
+
+    for (double sample : samples)
+        stats.mean += sample;
+
+    stats.mean /= double(samples.size());
+    stats.p50 = at(0.50);
+    stats.p90 = at(0.90);
+    stats.p99 = at(0.99);
+    stats.max = samples.back();
+    return stats;
+}
+
+// Undo everything, then Redo everything, timing each call.
+static void ReportUndoRedo(const char* manager, HistoryContext& context)
+{
+    std::vector<double> undo;
+    std::vector<double> redo;
+    undo.reserve(context.GetStackData().size());
+    redo.reserve(context.GetStackData().size());
+
+    while (true)
+    {
+        auto start = BenchClock::now();
+        if (!context.Undo())
+            break;
+        undo.push_back(NanosecondsSince(start));
+    }
+
+    while (true)
+    {
+        auto start = BenchClock::now();
+        if (!context.Redo())
+            break;
+        redo.push_back(NanosecondsSince(start));
+    }
+
+    for (auto* samples : { &undo, &redo })
+    {
+        auto stats = Summarize(*samples);
+        Report(samples == &undo ? "undo_latency" : "redo_latency", manager, {
+            { "ops", double(samples->size()) },
+            { "mean_ns", stats.mean },
+            { "p50_ns", stats.p50 },
+            { "p90_ns", stats.p90 },
+            { "p99_ns", stats.p99 },
+            { "max_ns", stats.max } });
+    }
+}
+
+static std::vector<std::string> MakeKeys(size_t count)
+{
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        keys.push_back("key" + std::to_string(i));
+
+    return keys;
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+void HistoryBenchmark_Trivial(size_t count)
+{
+    TrivialManager mgr;
+    mgr.objects.reserve(count);
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < count; ++i)
+        mgr.AddNewObject();
+
+    double seconds = SecondsSince(start);
+    Report("push", "TrivialManager", { { "ops", double(count) }, { "seconds", seconds }, { "ops_per_s", double(count) / seconds } });
+
+    ReportUndoRedo("TrivialManager", mgr.context);
+}
+
+void HistoryBenchmark_Map(size_t count)
+{
+    auto keys = MakeKeys(count);
+    MapManager mgr;
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < count; ++i)
+        mgr.AddObject(keys[i], int(i));
+
+    double seconds = SecondsSince(start);
+    Report("push", "MapManager", { { "ops", double(count) }, { "seconds", seconds }, { "ops_per_s", double(count) / seconds } });
+
+    ReportUndoRedo("MapManager", mgr.context);
+}
+
+// Memento cost: RemoveObject saves a memento on push and loads it on undo.
+// MapWithRemoveManager uses HISTORY_SAVE / HISTORY_LOAD, MementoManager a typed memento.
+template<typename Manager>
+void HistoryBenchmark_SaveLoad(const char* manager, size_t count)
+{
+    auto keys = MakeKeys(count);
+    Manager mgr;
+    for (size_t i = 0; i < count; ++i)
+        mgr.AddObject(keys[i], int(i));
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < count; ++i)
+        mgr.RemoveObject(keys[i]);
+    double saveSeconds = SecondsSince(start);
+
+    start = BenchClock::now();
+    for (size_t i = 0; i < count; ++i)
+        mgr.context.Undo();
+    double loadSeconds = SecondsSince(start);
+
+    Report("save_load", manager, {
+        { "ops", double(count) },
+        { "push_save_ns", saveSeconds * 1e9 / double(count) },
+        { "undo_load_ns", loadSeconds * 1e9 / double(count) } });
+}
+
+// Each Set saves the whole map before writing one key, as an undo step needing the full previous state does.
+// std::map is copied in full, HistoryPersistentMap shares all but the changed path.
+template<typename Map>
+struct SnapshotManager : ManagerBase
+{
+    Map objects;
+
+    bool Set(int key, int value)
+    {
+        HISTORY_PUSH(Set, key, value);
+
+        auto hOldObjects = objects;
+        HISTORY_SAVE(hOldObjects);
+
+        Write(objects, key, value);
+        return true;
+    }
+
+    bool Set_Undo(int /*key*/, int /*value*/)
+    {
+        HISTORY_POP();
+
+        Map hOldObjects;
+        HISTORY_LOAD(hOldObjects);
+        objects = hOldObjects;
+        return true;
+    }
+
+    static void Write(std::map<int, int>& map, int key, int value) { map[key] = value; }
+    static void Write(HistoryPersistentMap<int, int>& map, int key, int value) { map.Set(key, value); }
+};
+
+template<typename Map>
+void HistoryBenchmark_Snapshots(const char* manager, size_t size, size_t count)
+{
+    SnapshotManager<Map> mgr;
+    for (size_t i = 0; i < size; ++i)
+        SnapshotManager<Map>::Write(mgr.objects, int(i), int(i));
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < count; ++i)
+        mgr.Set(int(i * 7919 % size), -int(i));
+    double pushSeconds = SecondsSince(start);
+
+    start = BenchClock::now();
+    for (size_t i = 0; i < count; ++i)
+        mgr.context.Undo();
+    double undoSeconds = SecondsSince(start);
+
+    Report("snapshot", manager, {
+        { "size", double(size) },
+        { "ops", double(count) },
+        { "push_save_ns", pushSeconds * 1e9 / double(count) },
+        { "undo_load_ns", undoSeconds * 1e9 / double(count) } });
+}
+
+// How StrokeManager saves its pixels.
+enum class StrokeSave
+{
+    Whole, // HISTORY_SAVE of the whole buffer
+    Diff,  // HISTORY_SAVE_DIFF: snapshot, keep the changed blocks
+    Pages, // HISTORY_SAVE_PAGES: keep the pages written
+};
+
+// Each Stroke overwrites a short run of a large pixel buffer.
+template<StrokeSave Save>
+struct StrokeManager : ManagerBase
+{
+    std::vector<uint32_t> pixels;
+
+    bool Stroke(size_t first, size_t count, uint32_t color)
+    {
+        HISTORY_PUSH(Stroke, first, count, color);
+
+        if constexpr (Save == StrokeSave::Diff)
+        {
+            HISTORY_SAVE_DIFF(pixels.data(), pixels.size() * sizeof(uint32_t));
+        }
+        else if constexpr (Save == StrokeSave::Pages)
+        {
+            HISTORY_SAVE_PAGES(pixels.data(), pixels.size() * sizeof(uint32_t));
+        }
+        else
+        {
+            auto& hPixels = pixels;
+            HISTORY_SAVE(hPixels);
+        }
+
+        std::fill(pixels.begin() + first, pixels.begin() + first + count, color);
+        return true;
+    }
+
+    bool Stroke_Undo(size_t, size_t, uint32_t)
+    {
+        HISTORY_POP();
+
+        if constexpr (Save == StrokeSave::Whole)
+        {
+            auto& hPixels = pixels;
+            HISTORY_LOAD(hPixels);
+        }
+        else
+        {
+            HISTORY_LOAD_DIFF(pixels.data());
+        }
+
+        return true;
+    }
+};
+
+template<StrokeSave Save>
+void HistoryBenchmark_BufferDiff(const char* manager, size_t pixels, size_t strokes)
+{
+    // Strokes need room to move around in: never less than twice the stroke length.
+    const size_t length = 4096;
+    pixels = std::max(pixels, 2 * length);
+
+    StrokeManager<Save> mgr;
+    mgr.pixels.resize(pixels);
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < strokes; ++i)
+        mgr.Stroke(i * 7919 % (pixels - length), length, uint32_t(i + 1));
+    double pushSeconds = SecondsSince(start);
+
+    start = BenchClock::now();
+    for (size_t i = 0; i < strokes; ++i)
+        mgr.context.Undo();
+    double undoSeconds = SecondsSince(start);
+
+    Report("buffer_diff", manager, {
+        { "buffer_kb", double(pixels * sizeof(uint32_t)) / 1024.0 },
+        { "ops", double(strokes) },
+        { "push_save_ns", pushSeconds * 1e9 / double(strokes) },
+        { "undo_load_ns", undoSeconds * 1e9 / double(strokes) } });
+}
+
+// MergingManager's functions as operation structs, for the HistoryVariantContext / HistoryLogContext engines.
+struct MergingOps
+{
+    struct SetOp
+    {
+        std::string key;
+        std::set<int> values;
+
+        // Memento
+        std::set<int> oldValues;
+        bool existed = false;
+
+        template<typename Context>
+        bool Do(MergingOps& mgr, Context&)
+        {
+            auto it = mgr.objects.find(key);
+            existed = it != mgr.objects.end();
+            if (existed)
+                oldValues = it->second;
+
+            return Redo(mgr);
+        }
+
+        bool Undo(MergingOps& mgr)
+        {
+            if (existed)
+                mgr.objects[key] = oldValues;
+            else
+                mgr.objects.erase(key);
+
+            return true;
+        }
+
+        bool Redo(MergingOps& mgr)
+        {
+            mgr.objects[key] = values;
+            return true;
+        }
+    };
+
+    struct RemoveOp
+    {
+        std::string key;
+
+        // Memento
+        std::set<int> oldValues;
+
+        template<typename Context>
+        bool Do(MergingOps& mgr, Context&)
+        {
+            oldValues = mgr.objects[key];
+            return Redo(mgr);
+        }
+
+        bool Undo(MergingOps& mgr)
+        {
+            mgr.objects[key] = oldValues;
+            return true;
+        }
+
+        bool Redo(MergingOps& mgr)
+        {
+            mgr.objects.erase(key);
+            return true;
+        }
+    };
+
+    // No effects of its own - everything happens in the nested records.
+    struct MergeOp
+    {
+        std::set<std::string> keys;
+        std::string newKey;
+
+        template<typename Context>
+        bool Do(MergingOps& mgr, Context& context)
+        {
+            std::set<int> newValues;
+            for (auto&& key : keys)
+                for (int value : mgr.objects[key])
+                    newValues.insert(value);
+
+            for (auto&& key : keys)
+                context.Push(RemoveOp{ key, {} });
+
+            context.Push(SetOp{ newKey, std::move(newValues), {}, false });
+            return true;
+        }
+
+        bool Undo(MergingOps&) { return true; }
+        bool Redo(MergingOps&) { return true; }
+    };
+
+    std::map<std::string, std::set<int>> objects;
+};
+
+// MergingManager on a closed operation set: no virtual calls, no std::function, records stored by value.
+struct VariantMergingManager : MergingOps
+{
+    HistoryVariantContext<MergingOps, SetOp, RemoveOp, MergeOp> context{ *this };
+
+    bool SetObject(const std::string& key, const std::set<int>& values) { return context.Push(SetOp{ key, values, {}, false }); }
+    bool MergeObjects(const std::set<std::string>& keys, const std::string& newKey) { return context.Push(MergeOp{ keys, newKey }); }
+};
+
+// MergingManager on the byte log: records are entries in one contiguous buffer.
+struct LogMergingManager : MergingOps
+{
+    HistoryLogContext<MergingOps> context{ *this };
+
+    bool SetObject(const std::string& key, const std::set<int>& values) { return context.Push(SetOp{ key, values, {}, false }); }
+    bool MergeObjects(const std::set<std::string>& keys, const std::string& newKey) { return context.Push(MergeOp{ keys, newKey }); }
+};
+
+// MergingManager on HistoryLinearContext: the same Do / Undo functions, typed mementos instead of HISTORY_SAVE.
+struct LinearMergingManager
+{
+    struct SetMemento
+    {
+        std::set<int> oldValues;
+        bool existed = false;
+    };
+
+    struct RemoveMemento
+    {
+        std::set<int> oldValues;
+    };
+
+    struct MergeMemento
+    {
+        std::set<int> newValues;
+        bool computed = false;
+    };
+
+    LinearMergingManager()
+    {
+        HistoryLinearContext::SetContext(&context);
+    }
+
+    std::map<std::string, std::set<int>> objects;
+    HistoryLinearContext context;
+
+    bool SetObject(const std::string& key, const std::set<int>& values)
+    {
+        HISTORY_LINEAR_PUSH_MEMENTO(SetObject, SetMemento, key, values);
+
+        auto it = objects.find(key);
+        if (it != objects.end())
+        {
+            auto& memento = HISTORY_LINEAR_MEMENTO(SetMemento);
+            memento.oldValues = it->second;
+            memento.existed = true;
+        }
+
+        objects[key] = values;
+        return true;
+    }
+
+    bool SetObject_Undo(const std::string& key, const std::set<int>&)
+    {
+        HISTORY_LINEAR_POP();
+
+        auto& memento = HISTORY_LINEAR_MEMENTO(SetMemento);
+        if (memento.existed)
+            objects[key] = memento.oldValues;
+        else
+            objects.erase(key);
+
+        return true;
+    }
+
+    bool RemoveObject(const std::string& key)
+    {
+        HISTORY_LINEAR_PUSH_MEMENTO(RemoveObject, RemoveMemento, key);
+
+        HISTORY_LINEAR_MEMENTO(RemoveMemento).oldValues = objects[key];
+        objects.erase(key);
+        return true;
+    }
+
+    bool RemoveObject_Undo(const std::string& key)
+    {
+        HISTORY_LINEAR_POP();
+
+        objects[key] = HISTORY_LINEAR_MEMENTO(RemoveMemento).oldValues;
+        return true;
+    }
+
+    bool MergeObjects(const std::set<std::string>& keys, const std::string& newKey)
+    {
+        HISTORY_LINEAR_PUSH_MEMENTO(MergeObjects, MergeMemento, keys, newKey);
+
+        // Computed once, Redo reuses it. Copied out, as the nested pushes may move the log.
+        std::set<int> newValues;
+        if (HISTORY_LINEAR_MEMENTO(MergeMemento).computed)
+        {
+            newValues = HISTORY_LINEAR_MEMENTO(MergeMemento).newValues;
+        }
+        else
+        {
+            for (auto&& key : keys)
+                for (int value : objects[key])
+                    newValues.insert(value);
+
+            HISTORY_LINEAR_MEMENTO(MergeMemento).newValues = newValues;
+            HISTORY_LINEAR_MEMENTO(MergeMemento).computed = true;
+        }
+
+        for (auto&& key : keys)
+            RemoveObject(key);
+
+        SetObject(newKey, newValues);
+        return true;
+    }
+
+    bool MergeObjects_Undo(const std::set<std::string>& keys, const std::string& newKey)
+    {
+        HISTORY_LINEAR_POP();
+
+        SetObject_Undo(newKey, {});
+        for (auto rit = keys.rbegin(); rit != keys.rend(); ++rit)
+            RemoveObject_Undo(*rit);
+
+        return true;
+    }
+};
+
+// Compound records: every MergeObjects nests one RemoveObject per key plus a SetObject.
+// MergingManager runs through virtual calls and std::function, VariantMergingManager through std::visit,
+// LogMergingManager walks a byte log, LinearMergingManager keeps the Do / Undo functions on an Euler tour,
+// ContainerManager records HistoryMap diffs instead of saving whole values.
+template<typename Manager>
+void HistoryBenchmark_Merging(const char* manager, size_t count)
+{
+    for (int keysPerMerge : { 2, 8, 32 })
+    {
+        const size_t merges = std::max<size_t>(1, count / size_t(keysPerMerge + 1));
+        auto keys = MakeKeys(merges * keysPerMerge);
+
+        Manager mgr;
+        for (size_t i = 0; i < keys.size(); ++i)
+            mgr.SetObject(keys[i], { int(i) });
+
+        auto start = BenchClock::now();
+        for (size_t m = 0; m < merges; ++m)
+        {
+            std::set<std::string> sources(keys.begin() + m * keysPerMerge, keys.begin() + (m + 1) * keysPerMerge);
+            mgr.MergeObjects(sources, "merged" + std::to_string(m));
+        }
+        double pushSeconds = SecondsSince(start);
+
+        start = BenchClock::now();
+        for (size_t m = 0; m < merges; ++m)
+            mgr.context.Undo();
+        double undoSeconds = SecondsSince(start);
+
+        start = BenchClock::now();
+        for (size_t m = 0; m < merges; ++m)
+            mgr.context.Redo();
+        double redoSeconds = SecondsSince(start);
+
+        Report("merge", manager, {
+            { "ops", double(merges) },
+            { "keys_per_merge", double(keysPerMerge) },
+            { "push_ns", pushSeconds * 1e9 / double(merges) },
+            { "undo_ns", undoSeconds * 1e9 / double(merges) },
+            { "redo_ns", redoSeconds * 1e9 / double(merges) } });
+    }
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+// Each Nest pushes one record and nests the next level inside it.
+struct NestingManager : ManagerBase
+{
+    int counter = 0;
+
+    bool Nest(int depth)
+    {
+        HISTORY_PUSH(Nest, depth);
+        ++counter;
+        if (depth > 1)
+            Nest(depth - 1);
+        return true;
+    }
+
+    bool Nest_Undo(int depth)
+    {
+        HISTORY_POP();
+        if (depth > 1)
+            Nest_Undo(depth - 1);
+        --counter;
+        return true;
+    }
+};
+
+// NestingManager on the byte log: a chain is one contiguous range instead of a tree of stacks.
+struct LogNestingManager
+{
+    struct NestOp
+    {
+        int depth;
+
+        template<typename Context>
+        bool Do(LogNestingManager& mgr, Context& context)
+        {
+            ++mgr.counter;
+            if (depth > 1)
+                context.Push(NestOp{ depth - 1 });
+            return true;
+        }
+
+        bool Undo(LogNestingManager& mgr) { --mgr.counter; return true; }
+        bool Redo(LogNestingManager& mgr) { ++mgr.counter; return true; }
+    };
+
+    int counter = 0;
+    HistoryLogContext<LogNestingManager> context{ *this };
+
+    bool Nest(int depth) { return context.Push(NestOp{ depth }); }
+};
+
+// NestingManager on HistoryLinearContext: same functions, cursors over one sequence instead of a tree of stacks.
+struct LinearNestingManager
+{
+    LinearNestingManager()
+    {
+        HistoryLinearContext::SetContext(&context);
+    }
+
+    int counter = 0;
+    HistoryLinearContext context;
+
+    bool Nest(int depth)
+    {
+        HISTORY_LINEAR_PUSH(Nest, depth);
+        ++counter;
+        if (depth > 1)
+            Nest(depth - 1);
+        return true;
+    }
+
+    bool Nest_Undo(int depth)
+    {
+        HISTORY_LINEAR_POP();
+        if (depth > 1)
+            Nest_Undo(depth - 1);
+        --counter;
+        return true;
+    }
+};
+
+template<typename Manager>
+void HistoryBenchmark_Nesting(const char* manager, size_t count)
+{
+    for (int depth : { 1, 4, 16, 64, 1024 })
+    {
+        const size_t chains = std::max<size_t>(1, count / size_t(depth));
+        Manager mgr;
+
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < chains; ++i)
+            mgr.Nest(depth);
+        double pushSeconds = SecondsSince(start);
+
+        start = BenchClock::now();
+        for (size_t i = 0; i < chains; ++i)
+            mgr.context.Undo();
+        double undoSeconds = SecondsSince(start);
+
+        start = BenchClock::now();
+        for (size_t i = 0; i < chains; ++i)
+            mgr.context.Redo();
+        double redoSeconds = SecondsSince(start);
+
+        const double records = double(chains) * depth;
+        Report("nesting", manager, {
+            { "depth", double(depth) },
+            { "records", records },
+            { "push_ns_per_record", pushSeconds * 1e9 / records },
+            { "undo_ns_per_record", undoSeconds * 1e9 / records },
+            { "redo_ns_per_record", redoSeconds * 1e9 / records } });
+    }
+}
+
+// TrivialManager on the byte log: one 8-byte operand, 32 bytes per record with its header.
+struct LogTrivialManager
+{
+    struct AddOp
+    {
+        uint64_t value;
+
+        template<typename Context>
+        bool Do(LogTrivialManager& mgr, Context&) { mgr.sum += value; return true; }
+        bool Undo(LogTrivialManager& mgr) { mgr.sum -= value; return true; }
+        bool Redo(LogTrivialManager& mgr) { mgr.sum += value; return true; }
+    };
+
+    uint64_t sum = 0;
+    HistoryLogContext<LogTrivialManager> context{ *this };
+
+    bool AddNewObject() { return context.Push(AddOp{ 1 }); }
+};
+
+// Push 10^3, 10^4, ... up to maxCount trivial records into one stack, then undo them all.
+// Stops before a run whose footprint, extrapolated from the previous run, exceeds budgetBytes.
+// @param getPresent: Present index of the manager's stack, checked against the pushed count
+template<typename Manager, typename GetPresent>
+void HistoryBenchmark_Scaling(const char* manager, size_t maxCount, double budgetBytes, GetPresent getPresent)
+{
+    double bytesPerRecord = 0;
+    for (size_t count = 1000; count <= maxCount; count *= 10)
+    {
+        if (bytesPerRecord * double(count) > budgetBytes)
+        {
+            Report("scaling_skipped", manager, { { "records", double(count) }, { "projected_gb", bytesPerRecord * double(count) / 1e9 } });
+            break;
+        }
+
+        auto mgr = std::make_unique<Manager>();
+        const double memoryBefore = CurrentMemoryKB();
+
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < count; ++i)
+            mgr->AddNewObject();
+        double pushSeconds = SecondsSince(start);
+        const size_t present = getPresent(*mgr);
+        bytesPerRecord = std::max(0.0, CurrentMemoryKB() - memoryBefore) * 1024.0 / double(count);
+
+        size_t undone = 0;
+        start = BenchClock::now();
+        while (mgr->context.Undo())
+            ++undone;
+        double undoSeconds = SecondsSince(start);
+
+        Report("scaling", manager, {
+            { "records", double(count) },
+            { "indices_ok", present == count && undone == count ? 1.0 : 0.0 },
+            { "push_ns", pushSeconds * 1e9 / double(count) },
+            { "undo_ns", undoSeconds * 1e9 / double(count) },
+            { "bytes_per_record", bytesPerRecord } });
+    }
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+// Expensive, reversible per-slot work. Each slot is touched by one record only.
+struct SlotManager
+{
+    SlotManager(size_t slotCount, int cost)
+        : slots(slotCount)
+        , cost(cost)
+    {
+        History::SetContext(&context);
+    }
+
+    HistoryContext context;
+    std::vector<uint64_t> slots;
+    int cost;
+
+    uint64_t Burn(uint64_t value) const
+    {
+        for (int i = 0; i < cost; ++i)
+        {
+            value ^= value << 13;
+            value ^= value >> 7;
+            value ^= value << 17;
+        }
+
+        return value;
+    }
+
+    bool Scramble(size_t slot, uint64_t seed)
+    {
+        HISTORY_PUSH(Scramble, slot, seed);
+
+        uint64_t hOld = slots[slot];
+        HISTORY_SAVE(hOld);
+
+        slots[slot] = Burn(hOld ^ seed);
+        return true;
+    }
+
+    bool Scramble_Undo(size_t slot, uint64_t seed)
+    {
+        HISTORY_POP();
+
+        uint64_t hOld = 0;
+        HISTORY_LOAD(hOld);
+
+        // Pretend restoring is as expensive as scrambling.
+        volatile uint64_t check = Burn(hOld ^ seed);
+        (void)check;
+
+        slots[slot] = hOld;
+        return true;
+    }
+
+    bool ScrambleAll(uint64_t seed, bool independent)
+    {
+        HISTORY_PUSH_COMPOUND(ScrambleAll, seed, independent);
+        if (independent)
+            HISTORY_INDEPENDENT();
+
+        for (size_t slot = 0; slot < slots.size(); ++slot)
+            Scramble(slot, seed);
+
+        return true;
+    }
+};
+
+// Undo / Redo the same compound record serially and in parallel.
+void HistoryBenchmark_ParallelUndo(HistoryWorkerPool& pool, size_t slotCount, int cost)
+{
+    double seconds[2] = {};
+    for (int independent = 0; independent < 2; ++independent)
+    {
+        SlotManager mgr(slotCount, cost);
+        mgr.context.SetWorkerPool(&pool);
+        mgr.ScrambleAll(0x9E3779B97F4A7C15ull, independent != 0);
+        const auto scrambled = mgr.slots;
+
+        auto start = BenchClock::now();
+        mgr.context.Undo();
+        mgr.context.Redo();
+        seconds[independent] = SecondsSince(start);
+
+        if (mgr.slots != scrambled)
+            std::fprintf(stderr, "ERROR: parallel round trip mismatch\n");
+    }
+
+    Report("parallel_undo", "SlotManager", {
+        { "slots", double(slotCount) },
+        { "cost", double(cost) },
+        { "threads", double(pool.GetThreadCount()) },
+        { "serial_s", seconds[0] },
+        { "parallel_s", seconds[1] },
+        { "speedup", seconds[0] / seconds[1] } });
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+// Push, Undo, Redo, Undo - the next push truncates the undone record.
+// Warms up first, then counts the heap allocations of the same cycles.
+// @param gated: History allocations fail the run
+// @returns false if gated and History allocated
+template<typename Manager, typename PushFunc>
+static bool CheckSteadyStateAllocations(const char* manager, Manager& mgr, PushFunc push, size_t cycles, bool gated)
+{
+    auto cycle = [&mgr, &push]()
+    {
+        push();
+        mgr.context.Undo();
+        mgr.context.Redo();
+        mgr.context.Undo();
+    };
+
+    for (size_t i = 0; i < cycles; ++i)
+        cycle();
+
+    HistoryAllocations::Reset();
+    for (size_t i = 0; i < cycles; ++i)
+        cycle();
+
+    const auto counts = HistoryAllocations::Get();
+    auto at = [&counts](HistoryAllocationCategory category) { return double(counts.count[size_t(category)]); };
+
+    Report("steady_state_allocations", manager, {
+        { "cycles", double(cycles) },
+        { "record", at(HistoryAllocationCategory::Record) },
+        { "delegate", at(HistoryAllocationCategory::Delegate) },
+        { "key_string", at(HistoryAllocationCategory::KeyString) },
+        { "data", at(HistoryAllocationCategory::Data) },
+        { "sub_context", at(HistoryAllocationCategory::SubContext) },
+        { "index", at(HistoryAllocationCategory::Index) },
+        { "other", at(HistoryAllocationCategory::Other) },
+        { "gated", gated ? 1.0 : 0.0 } });
+
+    if (gated && counts.HistoryCount())
+    {
+        std::fprintf(stderr, "ERROR: %s allocates in steady state:\n%s", manager, HistoryAllocations::Dump().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Records without mementos or with typed ones must not touch the global heap once warmed up.
+// HISTORY_SAVE / HISTORY_LOAD still allocate key strings and m_Data nodes, so they're reported only.
+bool HistoryBenchmark_SteadyStateAllocations(size_t cycles)
+{
+    if (!HistoryAllocations::IsTracking())
+        return true;
+
+    bool result = true;
+    {
+        TrivialManager mgr;
+        result &= CheckSteadyStateAllocations("TrivialManager", mgr, [&mgr]() { mgr.AddNewObject(); }, cycles, true);
+    }
+    {
+        NestingManager mgr;
+        result &= CheckSteadyStateAllocations("NestingManager", mgr, [&mgr]() { mgr.Nest(4); }, cycles, true);
+    }
+    {
+        MapWithRemoveManager mgr;
+        mgr.AddObject("key", 1);
+        CheckSteadyStateAllocations("MapWithRemoveManager", mgr, [&mgr]() { mgr.RemoveObject("key"); }, cycles, false);
+    }
+    {
+        // Typed mementos live inline in the record.
+        MementoManager mgr;
+        mgr.AddObject("key", 1);
+        result &= CheckSteadyStateAllocations("MementoManager", mgr, [&mgr]() { mgr.RemoveObject("key"); }, cycles, true);
+    }
+
+    return result;
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+// Random operations on a few integer slots, covering nesting, mementos, aborted and compound pushes.
+struct StressManager : ManagerBase
+{
+    static constexpr int SlotCount = 8;
+
+    std::vector<int> slots = std::vector<int>(SlotCount);
+
+    bool Set(int slot, int value)
+    {
+        HISTORY_PUSH(Set, slot, value);
+
+        int hOld = slots[slot];
+        HISTORY_SAVE(hOld);
+
+        slots[slot] = value;
+        return true;
+    }
+
+    bool Set_Undo(int slot, int /*value*/)
+    {
+        HISTORY_POP();
+
+        int hOld = 0;
+        HISTORY_LOAD(hOld);
+
+        slots[slot] = hOld;
+        return true;
+    }
+
+    // Sets count slots, then nests a smaller batch.
+    bool Batch(int first, int count, int depth, int value)
+    {
+        HISTORY_PUSH(Batch, first, count, depth, value);
+
+        for (int i = 0; i < count; ++i)
+            Set((first + i) % SlotCount, value + i);
+
+        if (depth > 1)
+            Batch(first + 1, count, depth - 1, value * 3);
+
+        return true;
+    }
+
+    bool Batch_Undo(int first, int count, int depth, int value)
+    {
+        HISTORY_POP();
+
+        // Reverse step order.
+        if (depth > 1)
+            Batch_Undo(first + 1, count, depth - 1, value * 3);
+
+        for (int i = count - 1; i >= 0; --i)
+            Set_Undo((first + i) % SlotCount, value + i);
+
+        return true;
+    }
+
+    // Negative values are refused after the push.
+    bool TrySet(int slot, int value)
+    {
+        HISTORY_PUSH(TrySet, slot, value);
+        if (value < 0)
+        {
+            HISTORY_ABORT_PUSH();
+            return false;
+        }
+
+        int hOld = slots[slot];
+        HISTORY_SAVE(hOld);
+
+        slots[slot] = value;
+        return true;
+    }
+
+    bool TrySet_Undo(int slot, int /*value*/)
+    {
+        HISTORY_POP();
+
+        int hOld = 0;
+        HISTORY_LOAD(hOld);
+
+        slots[slot] = hOld;
+        return true;
+    }
+
+    bool Fill(int value)
+    {
+        HISTORY_PUSH_COMPOUND(Fill, value);
+
+        for (int slot = 0; slot < SlotCount; ++slot)
+            Set(slot, value);
+
+        return true;
+    }
+};
+
+// Reference model: every state the manager went through, and the present one.
+struct StressModel
+{
+    std::vector<std::vector<int>> states = { std::vector<int>(StressManager::SlotCount) };
+    size_t present = 0;
+
+    void Push(const std::vector<int>& state)
+    {
+        states.resize(present + 1);
+        states.push_back(state);
+        ++present;
+    }
+};
+
+// One random sequence against the model.
+// @returns empty string on success, else what went wrong
+static std::string RunStressSequence(uint64_t seed, size_t operations, size_t& maxStack)
+{
+    std::mt19937_64 random(seed);
+    auto roll = [&random](int count) { return int(random() % uint64_t(count)); };
+
+    StressManager mgr;
+    StressModel model;
+
+    for (size_t step = 0; step < operations; ++step)
+    {
+        std::string operation;
+        const int dice = roll(100);
+
+        if (dice < 30)
+        {
+            operation = "Set";
+            mgr.Set(roll(StressManager::SlotCount), roll(1000));
+            model.Push(mgr.slots);
+        }
+        else if (dice < 40)
+        {
+            operation = "Batch";
+            mgr.Batch(roll(StressManager::SlotCount), 1 + roll(3), 1 + roll(4), roll(1000));
+            model.Push(mgr.slots);
+        }
+        else if (dice < 50)
+        {
+            operation = "TrySet";
+            const auto before = mgr.slots;
+            if (mgr.TrySet(roll(StressManager::SlotCount), roll(1000) - 500))
+            {
+                model.Push(mgr.slots);
+            }
+            else
+            {
+                if (mgr.slots != before)
+                    return "Aborted push changed the state at step " + std::to_string(step);
+
+                // The push already dropped the Redo records.
+                model.states.resize(model.present + 1);
+            }
+        }
+        else if (dice < 55)
+        {
+            operation = "Fill";
+            mgr.Fill(roll(1000));
+            model.Push(mgr.slots);
+        }
+        else if (dice < 77)
+        {
+            operation = "Undo";
+            if (mgr.context.Undo() != (model.present > 0))
+                return "Undo result differs from model at step " + std::to_string(step);
+
+            if (model.present)
+                --model.present;
+        }
+        else if (dice < 98)
+        {
+            operation = "Redo";
+            if (mgr.context.Redo() != (model.present + 1 < model.states.size()))
+                return "Redo result differs from model at step " + std::to_string(step);
+
+            if (model.present + 1 < model.states.size())
+                ++model.present;
+        }
+        else
+        {
+            operation = "Clear";
+            mgr.context.Clear();
+            model.states = { model.states[model.present] };
+            model.present = 0;
+        }
+
+        std::string error;
+        if (mgr.slots != model.states[model.present])
+            error = "State differs from model";
+        else if (mgr.context.GetStackData().size() != model.states.size())
+            error = "Stack size differs from model";
+        else if (mgr.context.Present() != mgr.context.GetStackData()[model.present])
+            error = "Present record differs from model";
+        else
+            mgr.context.CheckInvariants(&error);
+
+        if (!error.empty())
+            return error + " after " + operation + " at step " + std::to_string(step);
+
+        maxStack = std::max(maxStack, mgr.context.GetStackData().size());
+    }
+
+    // Round trip: everything undone must give the first state, everything redone the last.
+    while (mgr.context.Undo());
+    if (mgr.slots != model.states.front())
+        return "Full Undo differs from the first state";
+
+    while (mgr.context.Redo());
+    if (mgr.slots != model.states.back())
+        return "Full Redo differs from the last state";
+
+    std::string error;
+    if (!mgr.context.CheckInvariants(&error))
+        return error + " after the round trip";
+
+    return {};
+}
+
+// Runs random sequences, reporting throughput and resident memory growth of every run, then of all runs.
+// @returns false on the first sequence breaking the model or an invariant
+bool HistoryStress(size_t runs, size_t operations, uint64_t seed)
+{
+    const double startKB = CurrentMemoryKB();
+    size_t maxStack = 0;
+
+    auto start = BenchClock::now();
+    for (size_t run = 0; run < runs; ++run)
+    {
+        const double runStartKB = CurrentMemoryKB();
+        size_t runMaxStack = 0;
+
+        auto runStart = BenchClock::now();
+        const std::string error = RunStressSequence(seed + run, operations, runMaxStack);
+        if (!error.empty())
+        {
+            std::fprintf(stderr, "ERROR: stress seed %llu: %s\n", (unsigned long long)(seed + run), error.c_str());
+            return false;
+        }
+
+        const double runSeconds = SecondsSince(runStart);
+        Report("stress_run", "StressManager", {
+            { "seed", double(seed + run) },
+            { "ops", double(operations) },
+            { "seconds", runSeconds },
+            { "ops_per_s", double(operations) / runSeconds },
+            { "max_stack", double(runMaxStack) },
+            { "current_kb_delta", CurrentMemoryKB() - runStartKB } });
+
+        maxStack = std::max(maxStack, runMaxStack);
+    }
+
+    double seconds = SecondsSince(start);
+    Report("stress", "StressManager", {
+        { "runs", double(runs) },
+        { "ops", double(runs * operations) },
+        { "seconds", seconds },
+        { "ops_per_s", double(runs * operations) / seconds },
+        { "max_stack", double(maxStack) },
+        { "current_kb_delta", CurrentMemoryKB() - startKB } });
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "stress")
+    {
+        const size_t runs = argc > 2 ? size_t(std::strtoull(argv[2], nullptr, 10)) : 1000;
+        const size_t operations = argc > 3 ? size_t(std::strtoull(argv[3], nullptr, 10)) : 200;
+        const uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 1;
+        return HistoryStress(runs, operations, seed) ? 0 : 1;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "scale")
+    {
+        const size_t maxCount = argc > 2 ? size_t(std::strtoull(argv[2], nullptr, 10)) : 1000000000;
+        const double budgetBytes = (argc > 3 ? std::strtod(argv[3], nullptr) : 16.0) * 1e9;
+        HistoryBenchmark_Scaling<LogTrivialManager>("LogTrivialManager", maxCount, budgetBytes, [](const LogTrivialManager& mgr) { return mgr.context.GetPresentIdx(); });
+        HistoryBenchmark_Scaling<TrivialManager>("TrivialManager", maxCount, budgetBytes, [](const TrivialManager& mgr) { return mgr.context.GetStackData().size() - 1; });
+        return 0;
+    }
+
+    const size_t count = argc > 1 ? size_t(std::strtoull(argv[1], nullptr, 10)) : 1000000;
+
+    if (!HistoryBenchmark_SteadyStateAllocations(1000))
+        return 1;
+
+    HistoryBenchmark_Trivial(count);
+    HistoryBenchmark_Map(count);
+    HistoryBenchmark_SaveLoad<MapWithRemoveManager>("MapWithRemoveManager", count / 4);
+    HistoryBenchmark_SaveLoad<MementoManager>("MementoManager", count / 4);
+    HistoryBenchmark_Snapshots<std::map<int, int>>("SnapshotManager<std::map>", count / 10, 32);
+    HistoryBenchmark_Snapshots<HistoryPersistentMap<int, int>>("SnapshotManager<HistoryPersistentMap>", count / 10, 32);
+    HistoryBenchmark_BufferDiff<StrokeSave::Whole>("StrokeManager<HISTORY_SAVE>", count, 32);
+    HistoryBenchmark_BufferDiff<StrokeSave::Diff>("StrokeManager<HISTORY_SAVE_DIFF>", count, 32);
+    HistoryBenchmark_BufferDiff<StrokeSave::Pages>("StrokeManager<HISTORY_SAVE_PAGES>", count, 32);
+    HistoryBenchmark_Merging<MergingManager>("MergingManager", count / 4);
+    HistoryBenchmark_Merging<VariantMergingManager>("VariantMergingManager", count / 4);
+    HistoryBenchmark_Merging<LogMergingManager>("LogMergingManager", count / 4);
+    HistoryBenchmark_Merging<LinearMergingManager>("LinearMergingManager", count / 4);
+    HistoryBenchmark_Merging<ContainerManager>("ContainerManager", count / 4);
+    HistoryBenchmark_Nesting<NestingManager>("NestingManager", count / 4);
+    HistoryBenchmark_Nesting<LogNestingManager>("LogNestingManager", count / 4);
+    HistoryBenchmark_Nesting<LinearNestingManager>("LinearNestingManager", count / 4);
+
+    HistoryWorkerPool pool;
+    HistoryBenchmark_ParallelUndo(pool, 4096, 20000);
+    return 0;
+}
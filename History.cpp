@@ -1,220 +1,1853 @@
 #include "History.h"
+#include "HistoryStats.h"
+#include "HistoryTrace.h"
+#include "HistoryAllocations.h"
+#include "HistoryDiff.h"
+#include "HistoryPersistent.h"
+#include <algorithm>
+#include <ostream>
+#include <unordered_map>
+#include <cstdint>
+#include <thread>
 
-HistoryContext* History::s_Context = nullptr;
+// Epoch based reclamation for snapshot readers.
+// Readers pin the current epoch in a slot before loading the published snapshot.
+// The writer tags everything it removes with the epoch of removal, then advances the epoch.
+// Anything tagged below the oldest pinned epoch can no longer be reached by any reader.
+struct HistorySnapshotDomain
+{
+    static constexpr int MaxReaders = 64;
+
+    HistorySnapshotDomain()
+    {
+        for (auto& slot : readers)
+            slot.store(0);
+    }
+
+    ~HistorySnapshotDomain()
+    {
+        delete published.load();
+        for (auto& [epoch, snapshot] : retiredSnapshots)
+            delete snapshot;
+        for (auto& [epoch, record] : retiredRecords)
+            delete record;
+    }
+
+    // Free everything no reader can see anymore.
+    void Reclaim()
+    {
+        uint64_t oldest = epoch.load();
+        for (auto& slot : readers)
+        {
+            uint64_t pinned = slot.load();
+            if (pinned && pinned < oldest)
+                oldest = pinned;
+        }
+
+        auto reclaim = [oldest](auto& retired)
+        {
+            auto it = std::remove_if(retired.begin(), retired.end(), [oldest](auto& item)
+            {
+                if (item.first >= oldest)
+                    return false;
+
+                delete item.second;
+                return true;
+            });
+            retired.erase(it, retired.end());
+        };
+
+        reclaim(retiredSnapshots);
+        reclaim(retiredRecords);
+    }
+
+    // Global epoch. Starts at 1, as 0 marks a free reader slot.
+    std::atomic<uint64_t> epoch = 1;
+
+    // Epoch pinned by each reader, 0 if free.
+    std::atomic<uint64_t> readers[MaxReaders];
+
+    // Latest snapshot.
+    std::atomic<const HistorySnapshot*> published = nullptr;
+    uint64_t version = 0;
+
+    // Writer only. Removed objects with the epoch they were removed in.
+    std::vector<std::pair<uint64_t, const HistorySnapshot*>> retiredSnapshots;
+    std::vector<std::pair<uint64_t, History*>> retiredRecords;
+
+    // Writer only. Root stack indices pushed, undone or redone since the last snapshot.
+    std::vector<size_t> changed;
+};
+
+struct HistorySnapshot::Blocks
+{
+    // Entries of the record at root stack index i + 1: the record itself, then its subrecords in Visit() order.
+    HistoryPersistentVector<std::shared_ptr<const std::vector<HistorySnapshot::Entry>>> records;
+};
+
+// Location of every record of a root context's tree by ID.
+struct HistoryIndex
+{
+    std::unordered_map<HistoryId, HistoryLocation, std::hash<HistoryId>, std::equal_to<HistoryId>,
+        HistoryAllocator<std::pair<const HistoryId, HistoryLocation>>> locations;
+};
+
+// Change listeners of one context.
+struct HistoryChangeFeed
+{
+    std::vector<std::pair<size_t, HistoryChangeListener>> listeners;
+    size_t lastSubscription = 0;
+
+    // Recorded since the last delivery.
+    std::vector<HistoryChange> pending;
+
+    // Open HistoryChangeBatch scopes.
+    int batchDepth = 0;
+
+    void Deliver()
+    {
+        if (pending.empty() || batchDepth)
+            return;
+
+        // Listeners may trigger more changes - those go into the next batch.
+        std::vector<HistoryChange> batch;
+        batch.swap(pending);
+
+        for (size_t i = 0; i < listeners.size(); ++i)
+            listeners[i].second(batch);
+
+        // Keep the capacity.
+        if (pending.empty())
+        {
+            batch.clear();
+            pending.swap(batch);
+        }
+    }
+};
+
+// Serialized queue of asynchronous Undo / Redo requests of one context.
+struct HistoryAsyncState
+{
+    std::deque<std::packaged_task<bool()>> requests;
+
+    // A worker is draining the requests.
+    bool running = false;
+
+    // Queued + running requests. Polled lock-free by IsBusy().
+    std::atomic<int> inFlight = 0;
+
+    std::mutex mutex;
+    std::condition_variable idle;
+};
+
+// Free list of one HistoryPool block size.
+struct HistoryPoolBin
+{
+    std::mutex mutex;
+    void* head = nullptr;
+};
+
+static HistoryPoolBin s_PoolBins[HistoryPool::MaxBlockSize / HistoryPool::Granularity];
+
+void* HistoryPool::Allocate(size_t size)
+{
+    if (size > MaxBlockSize)
+        return ::operator new(size);
+
+    const size_t bin = size ? (size - 1) / Granularity : 0;
+    {
+        std::scoped_lock<std::mutex> lock(s_PoolBins[bin].mutex);
+        if (void* block = s_PoolBins[bin].head)
+        {
+            s_PoolBins[bin].head = *static_cast<void**>(block);
+            return block;
+        }
+    }
+
+    return ::operator new((bin + 1) * Granularity);
+}
+
+void HistoryPool::Deallocate(void* ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    if (size > MaxBlockSize)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+
+    const size_t bin = size ? (size - 1) / Granularity : 0;
+    std::scoped_lock<std::mutex> lock(s_PoolBins[bin].mutex);
+    *static_cast<void**>(ptr) = s_PoolBins[bin].head;
+    s_PoolBins[bin].head = ptr;
+}
+
+void HistoryPool::Trim()
+{
+    for (auto& bin : s_PoolBins)
+    {
+        std::scoped_lock<std::mutex> lock(bin.mutex);
+        while (void* block = bin.head)
+        {
+            bin.head = *static_cast<void**>(block);
+            ::operator delete(block);
+        }
+    }
+}
+
+namespace
+{
+    // Guards registration. Constant-initialized, so push sites may register during static initialization.
+    std::mutex s_OpMutex;
+    uint32_t s_OpCount = 0;
+}
+
+uint32_t HistoryOps::Add(const HistoryOp& newOp)
+{
+    const uint32_t op = s_OpCount++;
+    assert(op / ChunkSize < MaxChunks && "Too many History operations!");
+
+    auto& chunk = s_Chunks[op / ChunkSize];
+    HistoryOp* ops = chunk.load(std::memory_order_relaxed);
+    if (!ops)
+    {
+        ops = new HistoryOp[ChunkSize];
+        chunk.store(ops, std::memory_order_release);
+    }
+
+    ops[op % ChunkSize] = newOp;
+    return op;
+}
+
+uint32_t HistoryOps::Register(const std::string& label, bool (*redo)(History*), bool (*undo)(History*))
+{
+    HistoryOp op;
+    op.label = label;
+    op.redo = redo;
+    op.undo = undo;
+    return Register(op);
+}
+
+uint32_t HistoryOps::Register(const HistoryOp& op)
+{
+    std::scoped_lock<std::mutex> lock(s_OpMutex);
+    return Add(op);
+}
+
+uint32_t HistoryOps::GetCount()
+{
+    std::scoped_lock<std::mutex> lock(s_OpMutex);
+    return s_OpCount;
+}
+
+thread_local HistoryContext* History::s_Context = nullptr;
+thread_local const HistoryContext* HistoryContext::s_CursorContext = nullptr;
+thread_local size_t HistoryContext::s_CursorIdx = 0;
 bool History::s_Lock = false;
 
-HistoryContext* History::GetContext()
+HistoryContext* History::GetContext()
+{
+    return s_Context;
+}
+
+void History::SetContext(HistoryContext* newContext)
+{
+    s_Context = newContext;
+}
+
+void History::Disable()
+{
+    s_Lock = true;
+}
+
+void History::Enable()
+{
+    s_Lock = false;
+}
+
+HistoryContext* History::GetRootContext()
+{
+    auto* context = GetContext();
+    while (context->ParentContext())
+        context = context->ParentContext();
+
+    return context;
+}
+
+void* History::operator new(size_t size)
+{
+    return HistoryPool::Allocate(size);
+}
+
+void History::operator delete(void* ptr, size_t size)
+{
+    HistoryPool::Deallocate(ptr, size);
+}
+
+// Diffs between SaveDiff() and the end of their Do function, innermost last.
+static thread_local std::vector<HistoryBufferDiff*> s_PendingDiffs;
+
+HistoryBufferDiff* History::NewDiff(const std::string& key)
+{
+    if (History::s_Lock)
+        return nullptr;
+
+    // May not save in undo / redo.
+    if (m_SubContext.IsUndoingOrRedoing())
+        return nullptr;
+
+    HISTORY_ALLOCATION_SCOPE(Data);
+
+    auto& slot = m_Data[key];
+
+    // Saved twice by the same Do function: the older diff is replaced.
+    if (auto* old = std::any_cast<HistoryBufferDiff>(&slot); old && old->IsPending())
+    {
+        s_PendingDiffs.erase(std::find(s_PendingDiffs.begin(), s_PendingDiffs.end(), old));
+        old->Finish();
+    }
+
+    slot = HistoryBufferDiff();
+
+    auto* diff = std::any_cast<HistoryBufferDiff>(&slot);
+    s_PendingDiffs.push_back(diff);
+    return diff;
+}
+
+bool History::SaveDiff(const std::string& key, const void* data, size_t size)
+{
+#if HISTORY_TRACING
+    HistoryTraceScope trace(HistoryTraceCategory::Save, key);
+#endif
+
+    HistoryBufferDiff* diff = NewDiff(key);
+    if (!diff)
+        return false;
+
+    diff->Begin(data, size);
+    return true;
+}
+
+bool History::SavePages(const std::string& key, void* data, size_t size)
+{
+#if HISTORY_TRACING
+    HistoryTraceScope trace(HistoryTraceCategory::Save, key);
+#endif
+
+    HistoryBufferDiff* diff = NewDiff(key);
+    if (!diff)
+        return false;
+
+    diff->BeginPages(data, size);
+    return true;
+}
+
+bool History::LoadDiff(const std::string& key, void* data)
+{
+    if (History::s_Lock)
+        return false;
+
+    // May load only during undo/redo
+    if (!m_SubContext.IsUndoingOrRedoing())
+        return false;
+
+#if HISTORY_TRACING
+    HistoryTraceScope trace(HistoryTraceCategory::Load, key);
+#endif
+
+    std::string id;
+    {
+        HISTORY_ALLOCATION_SCOPE(KeyString);
+        id = key;
+
+        size_t it = id.find("_Undo");
+        if (it != std::string::npos)
+            id.erase(it);
+    }
+
+    auto it = m_Data.find(id);
+    if (it == m_Data.end())
+        return false;
+
+    const auto* diff = std::any_cast<HistoryBufferDiff>(&it->second);
+    if (!diff)
+        return false;
+
+    diff->Restore(data);
+    return true;
+}
+
+const std::string& History::GetName() const
+{
+    static const std::string s_Unnamed;
+    return s_Unnamed;
+}
+
+HistoryId History::NewID()
+{
+    static std::atomic<HistoryId> s_LastID = 0;
+    return s_LastID.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void HistoryContext::PrePush()
+{
+    if (History::s_Lock)
+        return;
+
+    if (m_PresentHistoryIdx < m_HistoryStack.size() - 1)
+        RecordChange(HistoryChangeKind::Truncated, m_PresentHistoryIdx + 1, m_HistoryStack.size() - 1, 0);
+
+    // Increment Present index
+    ++m_PresentHistoryIdx;
+
+    // Clear Redos.
+
+    while (m_HistoryStack.size() != m_PresentHistoryIdx)
+    {
+        DeleteRecord(m_HistoryStack.back());
+        m_HistoryStack.pop_back();
+    }
+}
+
+void HistoryContext::NotifyStackChanged()
+{
+    m_OnStackChanged(m_PresentHistoryIdx);
+
+    if (m_Feed)
+        m_Feed->Deliver();
+
+    if (m_Snapshots)
+        PublishSnapshot();
+}
+
+void HistoryContext::RecordChange(HistoryChangeKind kind, size_t first, size_t last, HistoryId id)
+{
+    // Removed records leave the snapshot by the stack size alone.
+    if (m_Snapshots && (kind == HistoryChangeKind::Pushed || kind == HistoryChangeKind::Undone || kind == HistoryChangeKind::Redone))
+        m_Snapshots->changed.push_back(first);
+
+    if (!m_Feed || m_Feed->listeners.empty())
+        return;
+
+    m_Feed->pending.push_back({ kind, first, last, id, m_PresentHistoryIdx });
+}
+
+void HistoryContext::DeleteRecord(History* record)
+{
+    auto* root = Root();
+
+    // Drop the record and everything nested in it from the index.
+    if (root->m_Index)
+    {
+        // Reused, so steady-state truncation doesn't allocate.
+        thread_local std::vector<const History*> pending;
+        pending.push_back(record);
+        while (!pending.empty())
+        {
+            const History* removed = pending.back();
+            pending.pop_back();
+            root->m_Index->locations.erase(removed->m_ID);
+
+            const auto& stack = removed->m_SubContext.m_HistoryStack;
+            pending.insert(pending.end(), stack.begin() + 1, stack.end());
+        }
+    }
+
+    if (root->m_Snapshots)
+        root->m_Snapshots->retiredRecords.emplace_back(root->m_Snapshots->epoch.load(), record);
+    else
+        delete record;
+}
+
+void HistoryContext::Register(size_t idx)
+{
+    HISTORY_ALLOCATION_SCOPE(Index);
+
+    if (!m_Root->m_Index)
+        m_Root->m_Index = std::make_unique<HistoryIndex>();
+
+    History* record = m_HistoryStack[idx];
+    m_Root->m_Index->locations[record->m_ID] = { record, this, idx, m_Depth };
+}
+
+void HistoryContext::Append(History* record)
+{
+    {
+        HISTORY_ALLOCATION_SCOPE(SubContext);
+        m_HistoryStack.push_back(record);
+    }
+
+    Register(m_HistoryStack.size() - 1);
+    RecordChange(HistoryChangeKind::Pushed, m_PresentHistoryIdx, m_PresentHistoryIdx, record->m_ID);
+}
+
+HistoryStack HistoryContext::NewStack()
+{
+    HISTORY_ALLOCATION_SCOPE(SubContext);
+    return HistoryStack(1);
+}
+
+const HistoryLocation* HistoryContext::Find(HistoryId id) const
+{
+    if (!m_Root->m_Index)
+        return nullptr;
+
+    const auto& locations = m_Root->m_Index->locations;
+    auto it = locations.find(id);
+    return it != locations.end() ? &it->second : nullptr;
+}
+
+bool HistoryContext::CheckInvariants(std::string* error /*= nullptr*/) const
+{
+    auto fail = [error](const HistoryContext* context, const std::string& what)
+    {
+        if (error)
+            *error = what + " (depth " + std::to_string(context->m_Depth) + ", present " + std::to_string(context->m_PresentHistoryIdx)
+                + ", size " + std::to_string(context->m_HistoryStack.size()) + ")";
+        return false;
+    };
+
+    struct Item
+    {
+        const HistoryContext* context;
+
+        // Whether the owning record is done (at or below its stack's present index).
+        bool done;
+    };
+
+    size_t records = 0;
+    std::vector<Item> pending = { { this, true } };
+    while (!pending.empty())
+    {
+        const auto [context, done] = pending.back();
+        pending.pop_back();
+
+        const auto& stack = context->m_HistoryStack;
+        const size_t size = stack.size();
+        if (stack.empty() || stack[0])
+            return fail(context, "Stack lost its sentinel");
+
+        if (context->m_PresentHistoryIdx >= size)
+            return fail(context, "Present index out of range");
+
+        if (context->m_IsUndoing || context->m_IsRedoing)
+            return fail(context, "Undo / Redo flag left set");
+
+        // Done records replayed all their subrecords, undone ones unwound down to the first.
+        if (context != this && size > 1 && context->m_PresentHistoryIdx != (done ? size - 1 : 1))
+            return fail(context, done ? "Subrecords of a done record not all present" : "Subrecords of an undone record not unwound");
+
+        if (context != this && size == 1 && context->m_PresentHistoryIdx)
+            return fail(context, "Present index of an empty stack");
+
+        for (size_t i = 1; i < size; ++i)
+        {
+            const History* record = stack[i];
+            if (!record)
+                return fail(context, "Null record at " + std::to_string(i));
+
+            const auto& sub = record->m_SubContext;
+            if (sub.m_ParentContext != context || sub.m_Root != m_Root || sub.m_Depth != context->m_Depth + 1)
+                return fail(context, "Broken parent link of " + record->GetLabel());
+
+            if (m_Root == this && m_Index)
+            {
+                const HistoryLocation* location = Find(record->m_ID);
+                if (!location || location->record != record || location->context != context || location->index != i || location->depth != context->m_Depth)
+                    return fail(context, "Index out of date for " + record->GetLabel());
+            }
+
+            ++records;
+            pending.push_back({ &sub, done && i <= context->m_PresentHistoryIdx });
+        }
+    }
+
+    if (m_Root == this && m_Index && m_Index->locations.size() != records)
+        return fail(this, "Index holds " + std::to_string(m_Index->locations.size()) + " entries for " + std::to_string(records) + " records");
+
+    return true;
+}
+
+// HistoryContext::m_RunState: the number of set flags in the low 16 bits, a count of changes in the 48 above them.
+// States of different roots may match, caches tell roots apart by m_RunRootId.
+static constexpr uint64_t RunFlagMask = 0xFFFF;
+static constexpr uint64_t RunChange = RunFlagMask + 1;
+static std::atomic<uint64_t> s_RunRoots = 0;
+
+HistoryContext::HistoryContext(HistoryContext* parent /*= nullptr*/)
+    : m_ParentContext(parent)
+    , m_Root(parent ? parent->m_Root : this)
+    , m_Depth(parent ? parent->m_Depth + 1 : 0)
+    , m_OnStackChanged([](size_t) {})
+{
+    if (!parent)
+        m_RunRootId = s_RunRoots.fetch_add(1) + 1;
+}
+
+HistoryContext::~HistoryContext()
+{
+    // Workers still reference this context.
+    if (HistoryAsyncState* async = m_Async.load(std::memory_order_acquire))
+    {
+        {
+            std::unique_lock<std::mutex> lock(async->mutex);
+            async->idle.wait(lock, [async]() { return !async->running && async->inFlight.load() == 0; });
+        }
+
+        delete async;
+    }
+
+    History* pending = m_PendingHead.exchange(nullptr, std::memory_order_acquire);
+    while (pending)
+    {
+        History* next = pending->m_PendingNext;
+        delete pending;
+        pending = next;
+    }
+
+    // Detach all nested stacks first: deleting a record then never recurses into its subrecords,
+    // so tearing down a tree takes constant native stack space at any depth.
+    HistoryStack records;
+    records.swap(m_HistoryStack);
+    for (size_t i = 1; i < records.size(); ++i)
+    {
+        auto& subStack = records[i]->m_SubContext.m_HistoryStack;
+        if (subStack.size() > 1)
+        {
+            records.insert(records.end(), subStack.begin() + 1, subStack.end());
+            subStack.resize(1);
+        }
+    }
+
+    for (History* record : records)
+        delete record;
+}
+
+bool HistoryContext::Redo()
+{
+    if (History::s_Lock)
+        return false;
+
+    std::scoped_lock<std::mutex> lock(m_Mutex);
+
+	if (m_Stepper)
+		return false;
+
+	if (m_PresentHistoryIdx == m_HistoryStack.size() - 1)
+		return false;
+
+#if HISTORY_TRACING
+    HistoryTraceScope trace(HistoryTraceCategory::Redo, "Redo");
+#endif
+#if HISTORY_INSTRUMENTATION
+    // The whole record, compound ones included.
+    HistoryStatsScope stats(m_HistoryStack[m_PresentHistoryIdx + 1], HistoryOperation::Redo);
+#endif
+
+    // Compound objects replay their subrecords.
+    if (m_HistoryStack[m_PresentHistoryIdx + 1]->m_Compound)
+    {
+        HistoryStepper stepper(*this, false);
+        stepper.m_Parallel = true;
+        stepper.Step();
+        return stepper.Succeeded();
+    }
+
+    SetRunFlag(m_IsRedoing, true);
+	bool result = m_HistoryStack[++m_PresentHistoryIdx]->Redo();
+    SetRunFlag(m_IsRedoing, false);
+
+    RecordChange(HistoryChangeKind::Redone, m_PresentHistoryIdx, m_PresentHistoryIdx, m_HistoryStack[m_PresentHistoryIdx]->m_ID);
+
+    NotifyStackChanged();
+
+	return result;
+}
+
+bool HistoryContext::Undo()
+{
+    if (History::s_Lock)
+        return false;
+
+    std::scoped_lock<std::mutex> lock(m_Mutex);
+
+	if (m_Stepper)
+		return false;
+
+	if (!m_PresentHistoryIdx)
+		return false;
+
+#if HISTORY_TRACING
+    HistoryTraceScope trace(HistoryTraceCategory::Undo, "Undo");
+#endif
+#if HISTORY_INSTRUMENTATION
+    // The whole record, compound ones included.
+    HistoryStatsScope stats(m_HistoryStack[m_PresentHistoryIdx], HistoryOperation::Undo);
+#endif
+
+    // Compound objects unwind their subrecords.
+    if (m_HistoryStack[m_PresentHistoryIdx]->m_Compound)
+    {
+        HistoryStepper stepper(*this, true);
+        stepper.m_Parallel = true;
+        stepper.Step();
+        return stepper.Succeeded();
+    }
+
+    SetRunFlag(m_IsUndoing, true);
+	bool result = m_HistoryStack[m_PresentHistoryIdx]->Undo();
+	--m_PresentHistoryIdx;
+    SetRunFlag(m_IsUndoing, false);
+
+    RecordChange(HistoryChangeKind::Undone, m_PresentHistoryIdx + 1, m_PresentHistoryIdx + 1, m_HistoryStack[m_PresentHistoryIdx + 1]->m_ID);
+
+    NotifyStackChanged();
+
+	return result;
+}
+
+std::future<bool> HistoryContext::UndoAsync()
+{
+    return RunAsync(&HistoryContext::Undo);
+}
+
+std::future<bool> HistoryContext::RedoAsync()
+{
+    return RunAsync(&HistoryContext::Redo);
+}
+
+std::unique_ptr<HistoryStepper> HistoryContext::BeginUndo()
+{
+    if (History::s_Lock || m_Stepper || IsUndoingOrRedoing())
+        return nullptr;
+
+    if (!m_PresentHistoryIdx)
+        return nullptr;
+
+    return std::unique_ptr<HistoryStepper>(new HistoryStepper(*this, true));
+}
+
+std::unique_ptr<HistoryStepper> HistoryContext::BeginRedo()
+{
+    if (History::s_Lock || m_Stepper || IsUndoingOrRedoing())
+        return nullptr;
+
+    if (m_PresentHistoryIdx == m_HistoryStack.size() - 1)
+        return nullptr;
+
+    return std::unique_ptr<HistoryStepper>(new HistoryStepper(*this, false));
+}
+
+bool HistoryContext::IsBusy() const
+{
+    const HistoryAsyncState* async = m_Async.load(std::memory_order_acquire);
+    return async && async->inFlight.load(std::memory_order_acquire) > 0;
+}
+
+void HistoryContext::SetWorkerPool(HistoryWorkerPool* pool)
+{
+    m_WorkerPool = pool;
+}
+
+std::future<bool> HistoryContext::RunAsync(bool (HistoryContext::*op)())
+{
+    // Callers on several threads may race to create the queue: the first one to publish it wins.
+    HistoryAsyncState* async = m_Async.load(std::memory_order_acquire);
+    if (!async)
+    {
+        auto* newAsync = new HistoryAsyncState;
+        if (m_Async.compare_exchange_strong(async, newAsync, std::memory_order_acq_rel))
+            async = newAsync;
+        else
+            delete newAsync;
+    }
+
+    std::packaged_task<bool()> request([this, op, async]()
+    {
+        // Also when a delegate throws - else IsBusy() stays true and the destructor waits forever.
+        // Runs before the future is ready: once get() returns, IsBusy() no longer counts this request.
+        struct Finish
+        {
+            HistoryAsyncState* async;
+
+            ~Finish()
+            {
+                History::SetContext(nullptr);
+                async->inFlight.fetch_sub(1, std::memory_order_release);
+            }
+        } finish{ async };
+
+        // Workers have no context of their own.
+        History::SetContext(this);
+        return (this->*op)();
+    });
+    auto result = request.get_future();
+
+    bool startWorker = false;
+    {
+        std::scoped_lock<std::mutex> lock(async->mutex);
+        async->inFlight.fetch_add(1, std::memory_order_release);
+        async->requests.push_back(std::move(request));
+
+        // One worker at a time drains the queue, which keeps requests in order.
+        startWorker = !async->running;
+        async->running = true;
+    }
+
+    if (startWorker)
+    {
+        auto& pool = m_WorkerPool ? *m_WorkerPool : HistoryWorkerPool::Default();
+        pool.Submit([this]() { DrainAsync(); });
+    }
+
+    return result;
+}
+
+void HistoryContext::DrainAsync()
+{
+    HistoryAsyncState* async = m_Async.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(async->mutex);
+    while (!async->requests.empty())
+    {
+        auto request = std::move(async->requests.front());
+        async->requests.pop_front();
+
+        lock.unlock();
+        request();
+        lock.lock();
+    }
+
+    // Last touch of this context - the destructor may proceed once the lock is released.
+    async->running = false;
+    async->idle.notify_all();
+}
+
+// Flags of the contexts this thread looked up last, by nesting level, each ORed with its parents'.
+// Nested functions descend and return one level at a time, so the walk up the parents stops right away.
+struct HistoryRunCache
+{
+    struct Level
+    {
+        const HistoryContext* context = nullptr;
+        bool undoing = false;
+        bool redoing = false;
+    };
+
+    // Root and root state the levels were looked up in.
+    uint64_t rootId = 0;
+    uint64_t state = 0;
+    std::vector<Level> levels;
+
+    // Contexts walked past, reused.
+    std::vector<const HistoryContext*> path;
+};
+
+static thread_local HistoryRunCache s_RunCache;
+
+void HistoryContext::GetRunFlags(bool& undoing, bool& redoing) const
+{
+    undoing = false;
+    redoing = false;
+
+    // Nothing runs anywhere in the tree: no walk at all.
+    const uint64_t state = m_Root->m_RunState.load();
+    if (!(state & RunFlagMask))
+        return;
+
+    // The root has no parents to look up, they are hidden while locked.
+    if (!m_ParentContext || History::s_Lock)
+    {
+        undoing = m_IsUndoing;
+        redoing = m_IsRedoing;
+        return;
+    }
+
+    auto& cache = s_RunCache;
+    if (cache.rootId != m_Root->m_RunRootId || cache.state != state)
+    {
+        cache.rootId = m_Root->m_RunRootId;
+        cache.state = state;
+        cache.levels.clear();
+    }
+
+    auto cached = [&cache](const HistoryContext* context)
+    {
+        return size_t(context->m_Depth) < cache.levels.size() && cache.levels[context->m_Depth].context == context;
+    };
+
+    // Up to the nearest cached level, then fill in the ones below it.
+    const HistoryContext* context = this;
+    cache.path.clear();
+    while (context && !cached(context))
+    {
+        cache.path.push_back(context);
+        context = context->m_ParentContext;
+    }
+
+    if (context)
+    {
+        undoing = cache.levels[context->m_Depth].undoing;
+        redoing = cache.levels[context->m_Depth].redoing;
+    }
+
+    for (auto it = cache.path.rbegin(); it != cache.path.rend(); ++it)
+    {
+        undoing |= (*it)->m_IsUndoing.load();
+        redoing |= (*it)->m_IsRedoing.load();
+
+        const size_t depth = size_t((*it)->m_Depth);
+        if (cache.levels.size() <= depth)
+            cache.levels.resize(depth + 1);
+
+        cache.levels[depth] = { *it, undoing, redoing };
+    }
+}
+
+void HistoryContext::SetRunFlag(std::atomic<bool>& flag, bool value)
+{
+    if (flag.load(std::memory_order_relaxed) == value)
+        return;
+
+    // Published by the state update: readers load the state first.
+    flag.store(value, std::memory_order_relaxed);
+    m_Root->m_RunState.fetch_add(value ? RunChange + 1 : RunChange - 1);
+}
+
+bool HistoryContext::IsUndoing() const
+{
+    bool undoing, redoing;
+    GetRunFlags(undoing, redoing);
+    return undoing;
+}
+
+bool HistoryContext::IsRedoing() const
+{
+    bool undoing, redoing;
+    GetRunFlags(undoing, redoing);
+    return redoing;
+}
+
+bool HistoryContext::IsUndoingOrRedoing() const
+{
+    bool undoing, redoing;
+    GetRunFlags(undoing, redoing);
+    return undoing || redoing;
+}
+
+History* HistoryContext::Present() const
+{
+    if (History::s_Lock)
+        return nullptr;
+
+    if (s_CursorContext == this)
+        return m_HistoryStack[s_CursorIdx];
+
+    return m_HistoryStack[m_PresentHistoryIdx];
+}
+
+History* HistoryContext::PeekFuture() const
+{
+    if (History::s_Lock)
+        return nullptr;
+
+    if (m_PresentHistoryIdx < m_HistoryStack.size() - 1)
+        return m_HistoryStack[m_PresentHistoryIdx + 1];
+    else
+        return nullptr;
+}
+
+HistoryContext* HistoryContext::ParentContext() const
+{
+    if (History::s_Lock)
+        return nullptr;
+
+    return m_ParentContext;
+}
+
+std::string HistoryContext::Dump(int indentCount /*=0*/) const
+{
+    HistoryDumpOptions options;
+    options.indent = indentCount;
+
+    std::string result;
+    Dump([&result](std::string_view line) { result += line; }, options);
+    return result;
+}
+
+void HistoryContext::Dump(const std::function<void(std::string_view)>& sink, const HistoryDumpOptions& options /*= {}*/) const
+{
+    std::string line;
+    Visit([&](const HistoryVisit& visit)
+    {
+        const std::string& label = visit.record->GetLabel();
+        if (options.labelFilter.empty() || label.find(options.labelFilter) != std::string::npos)
+        {
+            line.assign(size_t(options.indent + visit.depth), '\t');
+            line += label;
+            if (visit.present)
+                line += " <<<";
+
+            line += '\n';
+            sink(line);
+        }
+
+        return options.maxDepth < 0 || visit.depth < options.maxDepth ? HistoryVisitResult::Descend : HistoryVisitResult::Skip;
+    }, options.first, options.last);
+}
+
+bool HistoryContext::Visit(const HistoryVisitor& visitor, size_t first /*= 1*/, size_t last /*= 0*/) const
+{
+    // Stack records still to visit, newest first. One frame per nesting level on the heap, none on the native stack.
+    struct Frame
+    {
+        const HistoryContext* context;
+        size_t next;
+        size_t first;
+        int depth;
+    };
+
+    const size_t top = m_HistoryStack.size() - 1;
+    last = last > 0 ? std::min(last, top) : top;
+
+    // Reused, so steady-state walks don't allocate. Nested walks from a visitor get their own.
+    thread_local std::vector<Frame> s_Spare;
+    std::vector<Frame> frames;
+    frames.swap(s_Spare);
+    frames.push_back({ this, last, std::max<size_t>(first, 1), 0 });
+
+    bool completed = true;
+    while (!frames.empty())
+    {
+        Frame& frame = frames.back();
+        if (frame.next < frame.first)
+        {
+            frames.pop_back();
+            continue;
+        }
+
+        const size_t idx = frame.next--;
+        const int depth = frame.depth;
+        const HistoryContext* context = frame.context;
+        const History* record = context->m_HistoryStack[idx];
+
+        const HistoryVisitResult result = visitor({ record, context, idx, depth, context->m_PresentHistoryIdx == idx });
+        if (result == HistoryVisitResult::Stop)
+        {
+            completed = false;
+            break;
+        }
+
+        const auto& subStack = record->m_SubContext.m_HistoryStack;
+        if (result == HistoryVisitResult::Descend && subStack.size() > 1)
+            frames.push_back({ &record->m_SubContext, subStack.size() - 1, 1, depth + 1 });
+    }
+
+    frames.clear();
+    if (frames.capacity() > s_Spare.capacity())
+        frames.swap(s_Spare);
+
+    return completed;
+}
+
+HistoryMemoryUsage HistoryContext::GetMemoryUsage() const
+{
+    // Approximate std::map / std::unordered_map node overhead: links and color / hash.
+    constexpr size_t TreeNodeLinks = 4 * sizeof(void*);
+    constexpr size_t HashNodeLinks = 2 * sizeof(void*);
+
+    auto poolBlock = [](size_t size)
+    {
+        return size <= HistoryPool::MaxBlockSize ? (size + HistoryPool::Granularity - 1) / HistoryPool::Granularity * HistoryPool::Granularity : size;
+    };
+
+    HistoryMemoryUsage usage;
+    usage.stackBytes = m_HistoryStack.capacity() * sizeof(History*);
+
+    Visit([&](const HistoryVisit& visit)
+    {
+        const History* record = visit.record;
+        ++usage.records;
+        usage.recordBytes += poolBlock(record->GetRecordSize());
+
+        // A sentinel-only stack is the fresh one every record starts with.
+        const auto& subStack = record->m_SubContext.m_HistoryStack;
+        usage.stackBytes += subStack.capacity() * sizeof(History*);
+
+        for (const auto& [key, value] : record->m_Data)
+        {
+            usage.dataBytes += sizeof(std::pair<const std::string, std::any>) + TreeNodeLinks;
+            if (key.capacity() > std::string().capacity())
+                usage.dataBytes += key.capacity() + 1;
+
+            if (const auto* diff = std::any_cast<HistoryBufferDiff>(&value))
+                usage.dataBytes += diff->GetChangedBytes();
+        }
+
+        return HistoryVisitResult::Descend;
+    });
+
+    if (m_Root == this && m_Index)
+    {
+        const auto& locations = m_Index->locations;
+        usage.indexBytes = locations.size() * poolBlock(sizeof(std::pair<const HistoryId, HistoryLocation>) + HashNodeLinks)
+            + locations.bucket_count() * sizeof(void*);
+    }
+
+    return usage;
+}
+
+void HistoryContext::Dump(std::ostream& out, const HistoryDumpOptions& options /*= {}*/) const
+{
+    Dump([&out](std::string_view line) { out.write(line.data(), std::streamsize(line.size())); }, options);
+}
+
+void HistoryContext::AbortPush()
+{
+    if (History::s_Lock)
+        return;
+
+    if (IsUndoingOrRedoing())
+        return;
+
+    --m_PresentHistoryIdx;
+
+    // A push not delivered yet: drop its Pushed change rather than reporting the push and its removal.
+    bool delivered = true;
+    if (m_Feed)
+    {
+        auto& pending = m_Feed->pending;
+        const HistoryId id = m_HistoryStack.back()->m_ID;
+        auto pushed = std::find_if(pending.begin(), pending.end(),
+            [id](const HistoryChange& change) { return change.kind == HistoryChangeKind::Pushed && change.id == id; });
+        if (pushed != pending.end())
+        {
+            pending.erase(pushed);
+            delivered = false;
+        }
+    }
+
+    if (delivered)
+        RecordChange(HistoryChangeKind::Truncated, m_HistoryStack.size() - 1, m_HistoryStack.size() - 1, 0);
+
+    DeleteRecord(m_HistoryStack.back());
+    m_HistoryStack.pop_back();
+    NotifyStackChanged();
+}
+
+void HistoryContext::Enqueue(History* record)
+{
+    assert(record && record->m_SubContext.m_ParentContext == this && "Record must be created for this context!");
+
+    History* head = m_PendingHead.load(std::memory_order_relaxed);
+    do
+    {
+        record->m_PendingNext = head;
+    } while (!m_PendingHead.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+}
+
+size_t HistoryContext::DrainPending()
+{
+    if (History::s_Lock)
+        return 0;
+
+    // Not a safe point - records would land in the middle of another operation.
+    if (IsUndoingOrRedoing())
+        return 0;
+
+    for (auto* context = History::GetContext(); context && context != this; context = context->m_ParentContext)
+    {
+        if (context->m_ParentContext == this)
+            return 0;
+    }
+
+    // Take the whole list and restore enqueue order.
+    History* reversed = m_PendingHead.exchange(nullptr, std::memory_order_acquire);
+    History* ordered = nullptr;
+    while (reversed)
+    {
+        History* next = reversed->m_PendingNext;
+        reversed->m_PendingNext = ordered;
+        ordered = reversed;
+        reversed = next;
+    }
+
+    size_t count = 0;
+    while (ordered)
+    {
+        History* next = ordered->m_PendingNext;
+        ordered->m_PendingNext = nullptr;
+
+        PrePush();
+        Append(ordered);
+        ordered = next;
+        ++count;
+    }
+
+    if (count)
+        NotifyStackChanged();
+
+    return count;
+}
+
+bool HistoryContext::HasPending() const
 {
-    return s_Context;
+    return m_PendingHead.load(std::memory_order_acquire) != nullptr;
 }
 
-void History::SetContext(HistoryContext* newContext)
+void HistoryContext::BindOnStackChanged(const std::function<void(size_t)>& func)
 {
-    s_Context = newContext;
+    if (History::s_Lock)
+        return;
+
+    m_OnStackChanged = func;
 }
 
-void History::Disable()
+void HistoryContext::UnbindOnStackChanged()
 {
-    s_Lock = true;
+    m_OnStackChanged = [](size_t) {};
 }
 
-void History::Enable()
+size_t HistoryContext::Subscribe(const HistoryChangeListener& listener)
 {
-    s_Lock = false;
+    if (!m_Feed)
+        m_Feed = std::make_unique<HistoryChangeFeed>();
+
+    m_Feed->listeners.emplace_back(++m_Feed->lastSubscription, listener);
+    return m_Feed->lastSubscription;
 }
 
-HistoryContext* History::GetRootContext()
+void HistoryContext::Unsubscribe(size_t subscription)
 {
-    auto* context = GetContext();
-    while (context->ParentContext())
-        context = context->ParentContext();
+    if (!m_Feed)
+        return;
 
-    return context;
+    auto& listeners = m_Feed->listeners;
+    listeners.erase(std::remove_if(listeners.begin(), listeners.end(), [subscription](const auto& listener) { return listener.first == subscription; }), listeners.end());
 }
 
-unsigned int History::NewID()
+HistoryChangeBatch::HistoryChangeBatch(HistoryContext& context)
+    : m_Context(context)
 {
-    static unsigned int id = 0;
-    return ++id;
+    if (!m_Context.m_Feed)
+        m_Context.m_Feed = std::make_unique<HistoryChangeFeed>();
+
+    ++m_Context.m_Feed->batchDepth;
 }
 
-void HistoryContext::PrePush()
+HistoryChangeBatch::~HistoryChangeBatch()
+{
+    --m_Context.m_Feed->batchDepth;
+    m_Context.m_Feed->Deliver();
+}
+
+void HistoryContext::Clear()
 {
     if (History::s_Lock)
         return;
 
-    // Increment Present index
-    ++m_PresentHistoryIdx;
+    for (size_t i = 1; i < m_HistoryStack.size(); ++i)
+        DeleteRecord(m_HistoryStack[i]);
 
-    // Clear Redos.
-    while (m_HistoryStack.size() != m_PresentHistoryIdx)
-    {
-        delete m_HistoryStack.back();
-        m_HistoryStack.pop_back();
-    }
+    const size_t last = m_HistoryStack.size() - 1;
+    m_PresentHistoryIdx = 0;
+    if (last > 0)
+        RecordChange(HistoryChangeKind::Cleared, 1, last, 0);
+
+    m_HistoryStack = NewStack();
+    NotifyStackChanged();
 }
 
-HistoryContext::HistoryContext(HistoryContext* parent /*= nullptr*/)
-    : m_ParentContext(parent)
-    , m_OnStackChanged([](int) {})
+void HistoryContext::EnableSnapshots()
 {
+    assert(!m_ParentContext && "Snapshots are published for the root context only!");
+    if (m_Snapshots)
+        return;
+
+    m_Snapshots = std::make_unique<HistorySnapshotDomain>();
+    PublishSnapshot();
 }
 
-bool HistoryContext::Redo()
+bool HistoryContext::SnapshotsEnabled() const
 {
-    if (History::s_Lock)
-        return false;
+    return m_Snapshots != nullptr;
+}
 
-    std::scoped_lock<std::mutex> lock(m_Mutex);
+void HistoryContext::PublishSnapshot()
+{
+    if (!m_Snapshots)
+        return;
 
-	if (m_PresentHistoryIdx == m_HistoryStack.size() - 1)
-		return false;
+    // Start from the previous snapshot's blocks - a root pointer copy, every node shared.
+    const HistorySnapshot* old = m_Snapshots->published.load();
+    auto blocks = old && old->entries.m_Blocks ? std::make_shared<HistorySnapshot::Blocks>(*old->entries.m_Blocks) : std::make_shared<HistorySnapshot::Blocks>();
+    size_t size = old ? old->entries.m_Size : 0;
 
-    m_IsRedoing = true;
-	bool result = m_HistoryStack[++m_PresentHistoryIdx]->Redo();
-    m_IsRedoing = false;
+    // Drop the blocks of removed records.
+    auto& records = blocks->records;
+    const size_t count = m_HistoryStack.size() - 1;
+    if (!count)
+    {
+        records.Clear();
+        size = 0;
+    }
 
-    m_OnStackChanged(m_PresentHistoryIdx);
+    while (records.GetSize() > count)
+    {
+        size -= records.Back()->size();
+        records.PopBack();
+    }
 
-	return result;
+    // Collect changed records again, then the new ones on top.
+    auto& changed = m_Snapshots->changed;
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (size_t idx : changed)
+    {
+        if (!idx || idx > records.GetSize())
+            continue;
+
+        auto block = CollectSnapshot(idx);
+        size += block->size();
+        size -= records[idx - 1]->size();
+        records.Set(idx - 1, std::move(block));
+    }
+    changed.clear();
+
+    while (records.GetSize() < count)
+    {
+        auto block = CollectSnapshot(records.GetSize() + 1);
+        size += block->size();
+        records.PushBack(std::move(block));
+    }
+
+    auto* snapshot = new HistorySnapshot();
+    snapshot->entries.m_Blocks = std::move(blocks);
+    snapshot->entries.m_Size = size;
+    snapshot->entries.m_PresentIdx = m_PresentHistoryIdx;
+    snapshot->presentIdx = m_PresentHistoryIdx;
+    snapshot->version = ++m_Snapshots->version;
+
+    // Swap first, then advance the epoch: readers pinned from now on can't see the old one.
+    m_Snapshots->published.exchange(snapshot);
+    if (old)
+        m_Snapshots->retiredSnapshots.emplace_back(m_Snapshots->epoch.load(), old);
+
+    m_Snapshots->epoch.fetch_add(1);
+    m_Snapshots->Reclaim();
 }
 
-bool HistoryContext::Undo()
+std::shared_ptr<const std::vector<HistorySnapshot::Entry>> HistoryContext::CollectSnapshot(size_t idx) const
 {
-    if (History::s_Lock)
-        return false;
+    auto entries = std::make_shared<std::vector<HistorySnapshot::Entry>>();
+    Visit([&entries](const HistoryVisit& visit)
+    {
+        entries->push_back({ visit.record, visit.depth, visit.present });
+        return HistoryVisitResult::Descend;
+    }, idx, idx);
 
-    std::scoped_lock<std::mutex> lock(m_Mutex);
+    return entries;
+}
 
-	if (!m_PresentHistoryIdx)
-		return false;
+HistorySnapshot::EntryList::const_iterator HistorySnapshot::EntryList::begin() const
+{
+    const_iterator it;
+    if (!m_Size)
+        return it;
 
-    m_IsUndoing = true;
-	bool result = m_HistoryStack[m_PresentHistoryIdx]->Undo();
-	--m_PresentHistoryIdx;
-    m_IsUndoing = false;
+    // Top of the stack first.
+    it.m_Blocks = m_Blocks.get();
+    it.m_PresentIdx = m_PresentIdx;
+    it.m_Block = m_Blocks->records.GetSize();
 
-    m_OnStackChanged(m_PresentHistoryIdx);
+    const auto& block = *m_Blocks->records.Back();
+    it.m_Entry = block.data();
+    it.m_BlockEnd = block.data() + block.size();
+    return it;
+}
 
-	return result;
+HistorySnapshot::EntryList::const_iterator& HistorySnapshot::EntryList::const_iterator::operator++()
+{
+    if (++m_Entry != m_BlockEnd)
+        return *this;
+
+    // On to the next older top-level record.
+    if (--m_Block == 0)
+    {
+        m_Entry = nullptr;
+        return *this;
+    }
+
+    const auto& block = *m_Blocks->records[m_Block - 1];
+    m_Entry = block.data();
+    m_BlockEnd = block.data() + block.size();
+    return *this;
 }
 
-bool HistoryContext::IsUndoing() const
+HistoryReadGuard::HistoryReadGuard(const HistoryContext& root)
+    : m_Domain(root.m_Snapshots.get())
 {
-    auto* context = this;
-    while (true)
+    static const HistorySnapshot s_Empty;
+    m_Snapshot = &s_Empty;
+
+    if (!m_Domain)
+        return;
+
+    // Pin the current epoch. Only spins if all reader slots are taken.
+    while (m_Slot < 0)
     {
-        if (context->m_IsUndoing)
-            return true;
+        for (int i = 0; i < HistorySnapshotDomain::MaxReaders; ++i)
+        {
+            uint64_t expected = 0;
+            if (m_Domain->readers[i].compare_exchange_strong(expected, m_Domain->epoch.load()))
+            {
+                m_Slot = i;
+                break;
+            }
+        }
 
-        if (context->ParentContext())
-            context = context->ParentContext();
-        else
-            return false;
+        if (m_Slot < 0)
+            std::this_thread::yield();
     }
+
+    m_Snapshot = m_Domain->published.load();
 }
 
-bool HistoryContext::IsRedoing() const
+HistoryReadGuard::~HistoryReadGuard()
 {
-    auto* context = this;
-    while (true)
+    if (m_Domain)
+        m_Domain->readers[m_Slot].store(0);
+}
+
+HistoryStepper::HistoryStepper(HistoryContext& context, bool undo)
+    : m_Context(context)
+    , m_Undo(undo)
+{
+    m_Context.m_Stepper = this;
+    m_Context.SetRunFlag(m_Undo ? m_Context.m_IsUndoing : m_Context.m_IsRedoing, true);
+
+    const size_t target = m_Undo ? m_Context.m_PresentHistoryIdx : m_Context.m_PresentHistoryIdx + 1;
+    PushFrame(&m_Context, target, target);
+
+    // Count leaf subrecords for progress reports.
+    std::vector<const History*> pending = { m_Context.m_HistoryStack[target] };
+    while (!pending.empty())
     {
-        if (context->m_IsRedoing)
-            return true;
+        const History* record = pending.back();
+        pending.pop_back();
 
-        if (context->ParentContext())
-            context = context->ParentContext();
-        else
-            return false;
+        if (!record->m_Compound)
+        {
+            ++m_TotalSteps;
+            continue;
+        }
+
+        const auto& stack = record->m_SubContext.m_HistoryStack;
+        for (size_t i = 1; i < stack.size(); ++i)
+            pending.push_back(stack[i]);
     }
 }
 
-bool HistoryContext::IsUndoingOrRedoing() const
+HistoryStepper::~HistoryStepper()
 {
-    return IsUndoing() || IsRedoing();
+    if (!m_Finished)
+        Cancel();
 }
 
-History* HistoryContext::Present() const
+bool HistoryStepper::Step(std::chrono::microseconds budget /*= std::chrono::microseconds::max()*/)
 {
-    if (History::s_Lock)
-        return nullptr;
+    using Clock = std::chrono::steady_clock;
 
-    return m_HistoryStack[m_PresentHistoryIdx];
+    if (m_Finished)
+        return true;
+
+    const auto deadline = budget == std::chrono::microseconds::max() ? Clock::time_point::max() : Clock::now() + budget;
+
+    // Subrecords expect to run within their own context.
+    auto* previousContext = History::GetContext();
+    while (Advance() && Clock::now() < deadline)
+    {
+    }
+    History::SetContext(previousContext);
+
+    // Don't keep a fully processed operation waiting for another call.
+    while (!m_Frames.empty() && PopFinishedFrame())
+    {
+    }
+
+    if (m_Frames.empty())
+        Finish();
+
+    return m_Finished;
 }
 
-History* HistoryContext::PeekFuture() const
+bool HistoryStepper::Advance()
 {
-    if (History::s_Lock)
-        return nullptr;
+    while (!m_Frames.empty())
+    {
+        if (PopFinishedFrame())
+            continue;
 
-    if (m_PresentHistoryIdx < (int(m_HistoryStack.size()) - 1))
-        return m_HistoryStack[m_PresentHistoryIdx + 1];
+        Frame& frame = m_Frames.back();
+        HistoryContext* context = frame.context;
+        const size_t idx = m_Undo ? frame.next-- : frame.next++;
+        History* record = context->m_HistoryStack[idx];
+        context->m_PresentHistoryIdx = idx;
+
+        if (record->m_Compound && record->m_Independent && m_Parallel)
+        {
+            RunParallel(record);
+            continue;
+        }
+
+        if (record->m_Compound)
+        {
+            const size_t lastIdx = record->m_SubContext.m_HistoryStack.size() - 1;
+            if (m_Undo)
+                PushFrame(&record->m_SubContext, lastIdx, 1);
+            else
+                PushFrame(&record->m_SubContext, 1, lastIdx);
+
+            continue;
+        }
+
+        History::SetContext(context);
+        m_Result &= RunTimed(record, m_Undo);
+        context->m_PresentHistoryIdx = idx;
+
+        m_Done.push_back({ context, idx });
+        return true;
+    }
+
+    return false;
+}
+
+bool HistoryStepper::PopFinishedFrame()
+{
+    const Frame& frame = m_Frames.back();
+    if (m_Undo ? frame.next >= frame.last : frame.next <= frame.last)
+        return false;
+
+    // Leave the Present where a full Undo / Redo would.
+    HistoryContext* context = frame.context;
+    const size_t lastIdx = context->m_HistoryStack.size() - 1;
+    if (m_Frames.size() == 1)
+        context->m_PresentHistoryIdx = m_Undo ? frame.last - 1 : frame.last;
     else
-        return nullptr;
+        context->m_PresentHistoryIdx = m_Undo ? std::min<size_t>(1, lastIdx) : lastIdx;
+
+    m_Frames.pop_back();
+    return true;
 }
 
-HistoryContext* HistoryContext::ParentContext() const
+void HistoryStepper::RunParallel(History* record)
 {
-    if (History::s_Lock)
-        return nullptr;
+    HistoryContext* context = &record->m_SubContext;
+    const size_t lastIdx = context->m_HistoryStack.size() - 1;
 
-    return m_ParentContext;
+    // Subrecords sharing a conflict key form one ordered group, the rest go in chunks.
+    std::vector<std::vector<size_t>> groups;
+    std::unordered_map<size_t, size_t> keyedGroups;
+
+    auto& pool = m_Context.m_WorkerPool ? *m_Context.m_WorkerPool : HistoryWorkerPool::Default();
+    const size_t chunkSize = std::max<size_t>(1, lastIdx / (size_t(pool.GetThreadCount()) * 8));
+    size_t openChunk = SIZE_MAX;
+
+    for (size_t n = 1; n <= lastIdx; ++n)
+    {
+        const size_t idx = m_Undo ? lastIdx + 1 - n : n;
+        const size_t key = context->m_HistoryStack[idx]->m_ConflictKey;
+
+        size_t group;
+        if (key)
+        {
+            auto [it, inserted] = keyedGroups.emplace(key, groups.size());
+            if (inserted)
+                groups.emplace_back();
+            group = it->second;
+        }
+        else
+        {
+            if (openChunk == SIZE_MAX || groups[openChunk].size() >= chunkSize)
+            {
+                openChunk = groups.size();
+                groups.emplace_back();
+            }
+            group = openChunk;
+        }
+
+        groups[group].push_back(idx);
+    }
+
+    std::atomic<bool> result = true;
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(groups.size());
+    for (auto& group : groups)
+    {
+        tasks.push_back([this, context, &group, &result]()
+        {
+            auto* previousContext = History::GetContext();
+            for (size_t idx : group)
+            {
+                if (!RunRecord(context, idx, m_Undo))
+                    result = false;
+            }
+            History::SetContext(previousContext);
+        });
+    }
+
+    pool.RunAll(tasks);
+
+    m_Result &= result.load();
+    context->m_PresentHistoryIdx = m_Undo ? std::min<size_t>(1, lastIdx) : lastIdx;
 }
 
-std::string HistoryContext::Dump(int indentCount /*=0*/) const
+bool HistoryStepper::RunRecord(HistoryContext* context, size_t idx, bool undo)
 {
-    std::string result;
-    std::string tabs;
-    for (int i = 0; i < indentCount; ++i)
-        tabs += '\t';
+    // Compound records being replayed, innermost last: their subcontext and the next subrecord's position.
+    // On the heap, so nesting depth doesn't cost native stack.
+    struct Frame
+    {
+        HistoryContext* context;
+        size_t next;
+    };
 
-    for (int i = int(m_HistoryStack.size()) - 1; i > 0; --i)
+    std::vector<Frame> frames;
+    bool result = true;
+    while (true)
     {
-        std::string record = tabs + m_HistoryStack[i]->m_Label;
-        if (m_PresentHistoryIdx == i)
-            record += " <<<";
+        History* record = context->m_HistoryStack[idx];
+        if (record->m_Compound)
+        {
+            // The subcontext belongs to this task alone.
+            frames.push_back({ &record->m_SubContext, 1 });
+        }
+        else
+        {
+            auto* previousCursor = HistoryContext::s_CursorContext;
+            auto previousIdx = HistoryContext::s_CursorIdx;
+            HistoryContext::s_CursorContext = context;
+            HistoryContext::s_CursorIdx = idx;
+
+            History::SetContext(context);
+            result &= RunTimed(record, undo);
+
+            HistoryContext::s_CursorContext = previousCursor;
+            HistoryContext::s_CursorIdx = previousIdx;
+        }
 
-        record += '\n';
-        result += record;
-        result += m_HistoryStack[i]->m_SubContext.Dump(indentCount + 1);
+        // Next subrecord of the innermost unfinished compound record.
+        while (true)
+        {
+            if (frames.empty())
+                return result;
+
+            Frame& frame = frames.back();
+            const size_t lastIdx = frame.context->m_HistoryStack.size() - 1;
+            if (frame.next <= lastIdx)
+            {
+                context = frame.context;
+                idx = undo ? lastIdx + 1 - frame.next : frame.next;
+                ++frame.next;
+                break;
+            }
+
+            frame.context->m_PresentHistoryIdx = undo ? std::min<size_t>(1, lastIdx) : lastIdx;
+            frames.pop_back();
+        }
     }
+}
 
-    return result;
+bool HistoryStepper::RunTimed(History* record, bool undo)
+{
+#if HISTORY_INSTRUMENTATION
+    HistoryStatsScope stats(record, undo ? HistoryOperation::Undo : HistoryOperation::Redo);
+#endif
+    return undo ? record->Undo() : record->Redo();
 }
 
-void HistoryContext::AbortPush()
+void HistoryStepper::PushFrame(HistoryContext* context, size_t first, size_t last)
 {
-    if (History::s_Lock)
-        return;
+    m_Cursors.emplace_back(context, context->m_PresentHistoryIdx);
+    m_Frames.push_back({ context, first, last });
+}
 
-    if (IsUndoingOrRedoing())
+void HistoryStepper::Cancel()
+{
+    if (m_Finished)
         return;
 
-    --m_PresentHistoryIdx;
-    m_HistoryStack.pop_back();
+    // Run the inverse of every processed subrecord, newest first.
+    m_Context.SetRunFlag(m_Undo ? m_Context.m_IsUndoing : m_Context.m_IsRedoing, false);
+    m_Context.SetRunFlag(m_Undo ? m_Context.m_IsRedoing : m_Context.m_IsUndoing, true);
+
+    auto* previousContext = History::GetContext();
+    for (auto it = m_Done.rbegin(); it != m_Done.rend(); ++it)
+    {
+        History* record = it->context->m_HistoryStack[it->idx];
+        it->context->m_PresentHistoryIdx = it->idx;
+
+        History::SetContext(it->context);
+        m_Result &= RunTimed(record, !m_Undo);
+    }
+    History::SetContext(previousContext);
+
+    for (auto it = m_Cursors.rbegin(); it != m_Cursors.rend(); ++it)
+        it->first->m_PresentHistoryIdx = it->second;
+
+    m_Context.SetRunFlag(m_Context.m_IsUndoing, false);
+    m_Context.SetRunFlag(m_Context.m_IsRedoing, false);
+    m_Context.m_Stepper = nullptr;
+    m_Frames.clear();
+    m_Finished = true;
+    m_Cancelled = true;
 }
 
-void HistoryContext::BindOnStackChanged(const std::function<void(int)>& func)
+void HistoryStepper::Finish()
 {
-    if (History::s_Lock)
-        return;
+    m_Context.SetRunFlag(m_Context.m_IsUndoing, false);
+    m_Context.SetRunFlag(m_Context.m_IsRedoing, false);
+    m_Context.m_Stepper = nullptr;
+    m_Finished = true;
 
-    m_OnStackChanged = func;
+    const size_t idx = m_Undo ? m_Context.m_PresentHistoryIdx + 1 : m_Context.m_PresentHistoryIdx;
+    m_Context.RecordChange(m_Undo ? HistoryChangeKind::Undone : HistoryChangeKind::Redone, idx, idx, m_Context.m_HistoryStack[idx]->m_ID);
+
+    m_Context.NotifyStackChanged();
 }
 
-void HistoryContext::UnbindOnStackChanged()
+HistoryWorkerPool::HistoryWorkerPool(unsigned threadCount /*= std::thread::hardware_concurrency()*/)
 {
-    m_OnStackChanged = [](int) {};
+    if (threadCount == 0)
+        threadCount = 1;
+
+    for (unsigned i = 0; i < threadCount; ++i)
+        m_Workers.push_back(std::make_unique<Worker>());
+
+    for (size_t i = 0; i < m_Workers.size(); ++i)
+        m_Workers[i]->thread = std::thread([this, i]() { WorkerLoop(i); });
 }
 
-void HistoryContext::Clear()
+HistoryWorkerPool::~HistoryWorkerPool()
 {
-    if (History::s_Lock)
-        return;
+    {
+        std::scoped_lock<std::mutex> lock(m_SleepMutex);
+        m_Stop = true;
+    }
 
-    m_PresentHistoryIdx = 0;
-    m_HistoryStack = std::vector<History*>(1);
-    m_OnStackChanged(0);
+    m_Wake.notify_all();
+    for (auto& worker : m_Workers)
+        worker->thread.join();
+}
+
+HistoryWorkerPool& HistoryWorkerPool::Default()
+{
+    static HistoryWorkerPool s_Pool;
+    return s_Pool;
+}
+
+void HistoryWorkerPool::Submit(std::function<void()> job)
+{
+    size_t target = CurrentWorker();
+    if (target == m_Workers.size())
+        target = m_NextWorker.fetch_add(1, std::memory_order_relaxed) % m_Workers.size();
+
+    {
+        std::scoped_lock<std::mutex> lock(m_Workers[target]->mutex);
+        m_Workers[target]->jobs.push_back(std::move(job));
+    }
+
+    m_QueuedJobs.fetch_add(1);
+    {
+        // Pairs with the sleep predicate, so the wakeup can't get lost.
+        std::scoped_lock<std::mutex> lock(m_SleepMutex);
+    }
+    m_Wake.notify_one();
+}
+
+void HistoryWorkerPool::RunAll(std::vector<std::function<void()>>& tasks)
+{
+    std::atomic<size_t> remaining = tasks.size();
+    for (auto& task : tasks)
+    {
+        Submit([&task, &remaining]()
+        {
+            task();
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    const size_t self = CurrentWorker();
+    while (remaining.load(std::memory_order_acquire))
+    {
+        if (!RunOne(self))
+            std::this_thread::yield();
+    }
+}
+
+bool HistoryWorkerPool::RunOne(size_t self)
+{
+    std::function<void()> job;
+
+    // Own jobs newest first - they're still warm in cache.
+    if (self < m_Workers.size())
+    {
+        Worker& worker = *m_Workers[self];
+        std::scoped_lock<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty())
+        {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+        }
+    }
+
+    // Steal the oldest job of someone else.
+    for (size_t i = 1; !job && i <= m_Workers.size(); ++i)
+    {
+        Worker& victim = *m_Workers[(self + i) % m_Workers.size()];
+        std::scoped_lock<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+        }
+    }
+
+    if (!job)
+        return false;
+
+    m_QueuedJobs.fetch_sub(1);
+    job();
+    return true;
+}
+
+size_t HistoryWorkerPool::CurrentWorker() const
+{
+    const auto id = std::this_thread::get_id();
+    for (size_t i = 0; i < m_Workers.size(); ++i)
+    {
+        if (m_Workers[i]->thread.get_id() == id)
+            return i;
+    }
+
+    return m_Workers.size();
+}
+
+void HistoryWorkerPool::WorkerLoop(size_t self)
+{
+    while (true)
+    {
+        if (RunOne(self))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_SleepMutex);
+        m_Wake.wait(lock, [this]() { return m_Stop || m_QueuedJobs.load() > 0; });
+
+        // Finish queued jobs before stopping.
+        if (m_Stop && m_QueuedJobs.load() == 0)
+            return;
+    }
 }
 
 HistoryPushController::HistoryPushController()
@@ -226,16 +1859,31 @@ HistoryPushController::HistoryPushController()
     if (History::GetContext()->IsUndoing())
         return;
 
+#if HISTORY_INSTRUMENTATION
+    HistoryStats::Begin(History::GetContext()->Present(), History::GetContext()->IsRedoing() ? HistoryOperation::Redo : HistoryOperation::Do);
+#endif
+#if HISTORY_TRACING
+    if (HistoryTrace::IsRecording())
+        HistoryTrace::Begin(History::GetContext()->IsRedoing() ? HistoryTraceCategory::Redo : HistoryTraceCategory::Do, History::GetContext()->Present()->GetLabel().c_str());
+#endif
+
+    m_DiffMark = s_PendingDiffs.size();
+
     // Push
     History::SetContext(&History::GetContext()->Present()->m_SubContext);
 }
 
 HistoryPushController::~HistoryPushController()
+{
+    Pop();
+}
+
+void HistoryPushController::Pop(bool notify /*= true*/)
 {
     if (History::s_Lock)
         return;
 
-    // Already destroyed by ABORT_PUSH
+    // Already popped by ABORT_PUSH
     if (!active)
         return;
 
@@ -243,21 +1891,37 @@ HistoryPushController::~HistoryPushController()
     if (History::GetContext()->IsUndoing())
         return;
 
+    // The Do function is done with its buffers: keep only what it changed.
+    while (s_PendingDiffs.size() > m_DiffMark)
+    {
+        s_PendingDiffs.back()->Finish();
+        s_PendingDiffs.pop_back();
+    }
+
     // Pop
     History::SetContext(History::GetContext()->ParentContext());
 
     // If still in subcontext and in Redo, move Preset ptr as in Do() if able
     if (History::GetContext()->ParentContext()
+        && HistoryContext::s_CursorContext != History::GetContext()
         && History::GetContext()->IsRedoing()
-        && (History::GetContext()->m_PresentHistoryIdx < (int(History::GetContext()->m_HistoryStack.size()) - 1)))
+        && History::GetContext()->m_PresentHistoryIdx < History::GetContext()->m_HistoryStack.size() - 1)
     {
         ++History::GetContext()->m_PresentHistoryIdx;
     }
-    else if(!History::GetContext()->IsRedoing())
+    else if(!History::GetContext()->IsRedoing() && notify)
     {
-        History::GetContext()->m_OnStackChanged(History::GetContext()->m_PresentHistoryIdx);
+        History::GetContext()->NotifyStackChanged();
     }
 
+#if HISTORY_INSTRUMENTATION
+    HistoryStats::End();
+#endif
+#if HISTORY_TRACING
+    if (HistoryTrace::IsRecording())
+        HistoryTrace::End(History::GetContext()->IsRedoing() ? HistoryTraceCategory::Redo : HistoryTraceCategory::Do, "");
+#endif
+
     active = false;
 }
 
@@ -266,6 +1930,14 @@ HistoryPopController::HistoryPopController()
     if (History::s_Lock)
         return;
 
+#if HISTORY_INSTRUMENTATION
+    HistoryStats::Begin(History::GetContext()->Present(), HistoryOperation::Undo);
+#endif
+#if HISTORY_TRACING
+    if (HistoryTrace::IsRecording())
+        HistoryTrace::Begin(HistoryTraceCategory::Undo, History::GetContext()->Present()->GetLabel().c_str());
+#endif
+
     // Push
     History::SetContext(&History::GetContext()->Present()->m_SubContext);
 }
@@ -279,6 +1951,18 @@ HistoryPopController::~HistoryPopController()
     History::SetContext(History::GetContext()->ParentContext());
 
     // If still in subcontext, move Present ptr as in Undo() if able
-    if (History::GetContext()->ParentContext() && History::GetContext()->m_PresentHistoryIdx > 1)
+    if (History::GetContext()->ParentContext()
+        && HistoryContext::s_CursorContext != History::GetContext()
+        && History::GetContext()->m_PresentHistoryIdx > 1)
+    {
         --History::GetContext()->m_PresentHistoryIdx;
+    }
+
+#if HISTORY_INSTRUMENTATION
+    HistoryStats::End();
+#endif
+#if HISTORY_TRACING
+    if (HistoryTrace::IsRecording())
+        HistoryTrace::End(HistoryTraceCategory::Undo, "");
+#endif
 }
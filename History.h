@@ -25,21 +25,409 @@
 
 #pragma once
 #include <any>
+#include <array>
+#include <atomic>
 #include <vector>
 #include <map>
 #include <functional>
 #include <mutex>
+#include <memory>
+#include <new>
+#include <future>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <cassert>
+#include <iosfwd>
+#include <string_view>
+
+// 1 = time every delegate call into per-label histograms, see HistoryStats.h.
+#ifndef HISTORY_INSTRUMENTATION
+#define HISTORY_INSTRUMENTATION 0
+#endif
+
+// 1 = record begin / end events of History operations for HistoryTrace.h.
+#ifndef HISTORY_TRACING
+#define HISTORY_TRACING 0
+#endif
+
+#if HISTORY_TRACING
+#include "HistoryTrace.h"
+#endif
+
+// 1 = count heap allocations by History operation, see HistoryAllocations.h.
+#ifndef HISTORY_ALLOCATION_TRACKING
+#define HISTORY_ALLOCATION_TRACKING 0
+#endif
+
+#if HISTORY_ALLOCATION_TRACKING
+#include "HistoryAllocations.h"
+#define HISTORY_ALLOCATION_SCOPE(category) HistoryAllocationScope historyAllocationScope(HistoryAllocationCategory::category)
+#else
+#define HISTORY_ALLOCATION_SCOPE(category)
+#endif
 
 template<typename... Args>
 using DelegateType = std::function<bool(Args...)>;
 
 struct History;
+struct HistoryContext;
+struct HistorySnapshotDomain;
+struct HistoryChangeFeed;
+struct HistoryIndex;
+struct HistoryBufferDiff;
+
+// Unique address per type, identifies memento types without RTTI.
+template<typename T>
+const void* HistoryTypeTag()
+{
+    static const char s_Tag = 0;
+    return &s_Tag;
+}
+
+// Unique History object ID, see History::GetId().
+using HistoryId = uint64_t;
+
+// Recycles small blocks of History internals: records, stacks, index nodes.
+// Once warmed up, pushing and truncating records doesn't touch the global heap.
+// Thread-safe. Cached blocks are kept until Trim().
+struct HistoryPool
+{
+    // Blocks up to this size are recycled, bigger ones come from the global heap.
+    static constexpr size_t MaxBlockSize = 1024;
+    static constexpr size_t Granularity = 16;
+
+    static void* Allocate(size_t size);
+    static void Deallocate(void* ptr, size_t size);
+
+    // Return all cached blocks to the global heap.
+    static void Trim();
+};
+
+// Standard allocator on top of HistoryPool.
+template<typename T>
+struct HistoryAllocator
+{
+    static_assert(alignof(T) <= HistoryPool::Granularity, "HistoryPool blocks are only 16-byte aligned");
+
+    using value_type = T;
+
+    HistoryAllocator() = default;
+
+    template<typename U>
+    HistoryAllocator(const HistoryAllocator<U>&) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(HistoryPool::Allocate(count * sizeof(T))); }
+    void deallocate(T* ptr, size_t count) { HistoryPool::Deallocate(ptr, count * sizeof(T)); }
+
+    template<typename U>
+    bool operator==(const HistoryAllocator<U>&) const { return true; }
+
+    template<typename U>
+    bool operator!=(const HistoryAllocator<U>&) const { return false; }
+};
+
+using HistoryStack = std::vector<History*, HistoryAllocator<History*>>;
+
+// Label and functions shared by all records of one push site or operation type.
+struct HistoryOp
+{
+    // Readable name
+    std::string label;
+
+    // Call the Do / Undo function with the object and parameters stored in the record.
+    // nullptr for records calling their own delegates, undo also for compound records.
+    bool (*redo)(History* record) = nullptr;
+    bool (*undo)(History* record) = nullptr;
+
+    // Operation objects stored inline in a HistoryLogContext, see HistoryLog.h.
+    bool (*redoPayload)(void* target, void* payload) = nullptr;
+    bool (*undoPayload)(void* target, void* payload) = nullptr;
+
+    // nullptr for trivially copyable payloads: they are memcpy'd and never destroyed.
+    void (*destroyPayload)(void* payload) = nullptr;
+    void (*relocatePayload)(void* to, void* from) = nullptr;
+
+    // Typed memento inside the payload if its type matches, else nullptr. See HistoryLinear.h.
+    void* (*mementoPayload)(void* payload, const void* type) = nullptr;
+};
+
+// Process-wide table of operations, records refer to theirs by index.
+// Each HISTORY_PUSH site registers itself on first use. Operations are never removed.
+struct HistoryOps
+{
+    static constexpr uint32_t ChunkSize = 256;
+    static constexpr uint32_t MaxChunks = 4096;
+
+    // Not in the table: records pushed with a runtime label through HistoryContext::Push() / Enqueue()
+    // keep the label themselves, so arbitrary labels never grow the table.
+    static constexpr uint32_t Named = ~uint32_t(0);
+
+    // Thread-safe. New operation for a push site.
+    static uint32_t Register(const std::string& label, bool (*redo)(History*), bool (*undo)(History*));
+    static uint32_t Register(const HistoryOp& op);
+
+    // Lock-free.
+    static const HistoryOp& Get(uint32_t op)
+    {
+        return s_Chunks[op / ChunkSize].load(std::memory_order_acquire)[op % ChunkSize];
+    }
+
+    // Number of operations registered so far.
+    static uint32_t GetCount();
+
+private:
+    // Caller holds the registration lock.
+    static uint32_t Add(const HistoryOp& op);
+
+    // Allocated on demand, never moved - Get() needs no lock.
+    inline static std::atomic<HistoryOp*> s_Chunks[MaxChunks] = {};
+};
+
+// Where a History object lives in the nested stacks.
+struct HistoryLocation
+{
+    History* record = nullptr;
+
+    // Stack holding the record and its index there.
+    HistoryContext* context = nullptr;
+    size_t index = 0;
+
+    // Nesting level, 0 for the root stack.
+    int depth = 0;
+};
+struct HistoryAsyncState;
+struct HistoryStepper;
+
+// Fixed set of worker threads running asynchronous and parallel History operations.
+// Each worker owns a job deque: it takes its own newest job first and steals the oldest jobs of others when idle.
+struct HistoryWorkerPool
+{
+    HistoryWorkerPool(unsigned threadCount = std::thread::hardware_concurrency());
+    ~HistoryWorkerPool();
+
+    HistoryWorkerPool(const HistoryWorkerPool&) = delete;
+    HistoryWorkerPool& operator=(const HistoryWorkerPool&) = delete;
+
+    // Pool used by contexts without their own. Created on first use.
+    static HistoryWorkerPool& Default();
+
+    // Run a job on any worker. Jobs submitted from a worker go to its own deque.
+    void Submit(std::function<void()> job);
+
+    // Run all tasks and wait for them. The calling thread helps, so this is safe to call from a worker.
+    void RunAll(std::vector<std::function<void()>>& tasks);
+
+    unsigned GetThreadCount() const { return unsigned(m_Workers.size()); }
+
+private:
+    struct Worker
+    {
+        std::deque<std::function<void()>> jobs;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    void WorkerLoop(size_t self);
+
+    // Run one job, own deque first, then steal. @param self: Calling worker's index, or any invalid index.
+    // @returns false if all deques are empty.
+    bool RunOne(size_t self);
+
+    // Index of the calling thread's worker in this pool, or m_Workers.size().
+    size_t CurrentWorker() const;
+
+    std::vector<std::unique_ptr<Worker>> m_Workers;
+    std::atomic<size_t> m_NextWorker = 0;
+    std::atomic<size_t> m_QueuedJobs = 0;
+
+    // Sleeping workers wait here for m_QueuedJobs.
+    std::mutex m_SleepMutex;
+    std::condition_variable m_Wake;
+    bool m_Stop = false;
+};
+
+// What happened to a stack, see HistoryContext::Subscribe().
+enum class HistoryChangeKind
+{
+    Pushed,     // Record [first] was pushed
+    Truncated,  // Records [first, last] were removed from the top: dropped Redos or an aborted push
+    Undone,     // Record [first] was undone
+    Redone,     // Record [first] was redone
+    Cleared     // Records [first, last] were wiped by Clear()
+};
+
+struct HistoryChange
+{
+    HistoryChangeKind kind;
+
+    // Stack index range the change applies to. first == last for single records.
+    size_t first = 0;
+    size_t last = 0;
+
+    // Pushed / Undone / Redone record, 0 otherwise.
+    HistoryId id = 0;
+
+    // Present index right after the change.
+    size_t presentIdx = 0;
+};
+
+// Receives the changes of one or more operations, oldest first.
+using HistoryChangeListener = std::function<void(const std::vector<HistoryChange>&)>;
+
+// Limits of the streaming HistoryContext::Dump().
+struct HistoryDumpOptions
+{
+    // Records [first, last] of the dumped stack, nested ones follow their parent. last = 0: up to the top.
+    size_t first = 1;
+    size_t last = 0;
+
+    // Nesting levels to descend into, -1 = all.
+    int maxDepth = -1;
+
+    // Only records whose label contains this. Their nested records are still searched.
+    std::string labelFilter;
+
+    // Tabs in front of every line.
+    int indent = 0;
+};
+
+// One record reached by HistoryContext::Visit().
+struct HistoryVisit
+{
+    const History* record = nullptr;
+
+    // Stack holding the record and its index there.
+    const HistoryContext* context = nullptr;
+    size_t index = 0;
+
+    // Nesting level below the visited context, 0 for its own stack.
+    int depth = 0;
+
+    // Is the Present of its context.
+    bool present = false;
+};
+
+// What HistoryContext::Visit() does after a record.
+enum class HistoryVisitResult
+{
+    // Go on with the record's subrecords, then its older siblings.
+    Descend,
+
+    // Leave its subrecords out.
+    Skip,
+
+    // End the walk.
+    Stop,
+};
+
+using HistoryVisitor = std::function<HistoryVisitResult(const HistoryVisit&)>;
+
+// Heap bytes held by a tree of records, see HistoryContext::GetMemoryUsage().
+struct HistoryMemoryUsage
+{
+    size_t records = 0;
+
+    // Record objects, rounded up to their HistoryPool blocks.
+    size_t recordBytes = 0;
+
+    // Stack arrays, by capacity.
+    size_t stackBytes = 0;
+
+    // Save() / SaveDiff() entries: map nodes, long keys and kept diff bytes.
+    // Other values hidden behind std::any count by their node only.
+    size_t dataBytes = 0;
+
+    // ID index of the root context.
+    size_t indexBytes = 0;
+
+    size_t GetTotal() const { return recordBytes + stackBytes + dataBytes + indexBytes; }
+};
+
+// Immutable view of a root context's stack, safe to read from any thread.
+// See HistoryContext::EnableSnapshots() and HistoryReadGuard.
+struct HistorySnapshot
+{
+    struct Entry
+    {
+        // Valid for as long as the snapshot is held. Only Label and ID may be read - both never change.
+        const History* record = nullptr;
+
+        // Nesting level, 0 for the root stack.
+        int depth = 0;
+
+        // Is the Present of its context.
+        bool present = false;
+    };
+
+    // Entries of each top-level record, shared between snapshots. Defined in History.cpp.
+    struct Blocks;
+
+    // All records in Dump() order: top of the stack first, subrecords right after their owner.
+    // Consecutive snapshots share the entries of every top-level record that wasn't pushed, undone or redone in between.
+    struct EntryList
+    {
+        struct const_iterator
+        {
+            // By value: the Present flag of top-level records comes from the snapshot's present index.
+            Entry operator*() const
+            {
+                Entry entry = *m_Entry;
+                if (!entry.depth)
+                    entry.present = m_Block == m_PresentIdx;
+
+                return entry;
+            }
+
+            const_iterator& operator++();
+
+            bool operator==(const const_iterator& other) const { return m_Entry == other.m_Entry; }
+            bool operator!=(const const_iterator& other) const { return m_Entry != other.m_Entry; }
+
+        private:
+            const Blocks* m_Blocks = nullptr;
+            size_t m_PresentIdx = 0;
+
+            // Root stack index of the current top-level record, the current entry and the end of the record's entries.
+            // m_Entry is nullptr past the last entry.
+            size_t m_Block = 0;
+            const Entry* m_Entry = nullptr;
+            const Entry* m_BlockEnd = nullptr;
+
+            friend struct EntryList;
+        };
+
+        const_iterator begin() const;
+        const_iterator end() const { return {}; }
+
+        size_t size() const { return m_Size; }
+        bool empty() const { return !m_Size; }
+
+    private:
+        std::shared_ptr<const Blocks> m_Blocks;
+        size_t m_Size = 0;
+        size_t m_PresentIdx = 0;
+
+        friend struct HistoryContext;
+    };
+
+    EntryList entries;
+
+    // Present index of the root stack.
+    size_t presentIdx = 0;
+
+    // Increases with every published snapshot.
+    uint64_t version = 0;
+};
 
 // History control object with operations stack.
 struct HistoryContext
 {
     HistoryContext(HistoryContext* parent = nullptr);
+    ~HistoryContext();
 
     // Ctrl+Y
     bool Redo();
@@ -47,6 +435,24 @@ struct HistoryContext
     // Ctrl+Z
     bool Undo();
 
+    // Undo() / Redo() on the worker pool. Requests run one at a time, in call order.
+    // Do not Push or call Undo() / Redo() directly while IsBusy().
+    // @returns Future with the Undo() / Redo() result.
+    std::future<bool> UndoAsync();
+    std::future<bool> RedoAsync();
+
+    // Undo() / Redo() in time slices. Compound records are processed one subrecord at a time,
+    // any other record in a single step. See HistoryStepper.
+    // @returns nullptr if there's nothing to Undo / Redo or another operation is in progress.
+    std::unique_ptr<HistoryStepper> BeginUndo();
+    std::unique_ptr<HistoryStepper> BeginRedo();
+
+    // Lock-free. True while any UndoAsync() / RedoAsync() request is queued or running.
+    bool IsBusy() const;
+
+    // Pool for UndoAsync() / RedoAsync(). nullptr = HistoryWorkerPool::Default().
+    void SetWorkerPool(HistoryWorkerPool* pool);
+
     // Checks whether currently in Undo() or Redo()
     bool IsUndoing() const;
     bool IsRedoing() const;
@@ -64,9 +470,35 @@ struct HistoryContext
     // Get read-only data.
     const auto& GetStackData() const { return m_HistoryStack; }
 
+    // O(1). Find a History object by its ID anywhere in this context's tree.
+    // @returns nullptr if no such object is on the stacks.
+    const HistoryLocation* Find(HistoryId id) const;
+
     // Dumps the current stack to string.
     std::string Dump(int indentCount = 0) const;
 
+    // Streams the stack line by line, newest record first. Iterative - any nesting depth is fine.
+    // @param sink: Receives each line including its '\n'. The view is only valid during the call.
+    void Dump(const std::function<void(std::string_view)>& sink, const HistoryDumpOptions& options = {}) const;
+    void Dump(std::ostream& out, const HistoryDumpOptions& options = {}) const;
+
+    // Walks the tree in Dump() order: newest record first, subrecords right after their owner.
+    // Keeps its position on an explicit stack, so any nesting depth runs in constant native stack space.
+    // The visitor may not change the tree.
+    // @param first, last: Records [first, last] of this stack, last = 0: up to the top
+    // @returns false if the visitor stopped the walk
+    bool Visit(const HistoryVisitor& visitor, size_t first = 1, size_t last = 0) const;
+
+    // Adds up the heap memory held by this context's tree. O(records), walks with Visit().
+    HistoryMemoryUsage GetMemoryUsage() const;
+
+    // Walks the whole tree and checks the structural invariants: present indices in range,
+    // nested present indices matching whether their record is done or undone, parent links and the ID index.
+    // Call only between operations.
+    // @param error: Receives the first violation found, if not nullptr
+    // @returns true if all invariants hold
+    bool CheckInvariants(std::string* error = nullptr) const;
+
     // Create a new History object on the Stack.
     // @param name: Label for debug purposes
     // @param do_func: Delegate for future Redo operations. Not called immediately.
@@ -83,49 +515,323 @@ struct HistoryContext
             return;
 
         PrePush();
-        m_HistoryStack.push_back(new HistoryWithParams<Args...>(this, name, std::forward<DelegateType<Args...>>(do_func), std::forward<DelegateType<Args...>>(undo_func), args...));
+
+        History* record;
+        {
+            HISTORY_ALLOCATION_SCOPE(Record);
+            record = new HistoryWithParams<Args...>(this, name, std::forward<DelegateType<Args...>>(do_func), std::forward<DelegateType<Args...>>(undo_func), args...);
+        }
+
+        Append(record);
     }
 
+    // Create a History object for a registered member / free function on the Stack. See HISTORY_PUSH.
+    // Records of ops without an undo function are compound. See HISTORY_PUSH_COMPOUND.
+    // @param op: The push site's operation, see HistoryRegisterOp()
+    // @param object: Object to call the functions on
+    // @param do_func: Only tells the parameter types
+    // @params args: Do / Undo function arguments to store and reuse.
+    template<typename Memento = void, typename C, typename B, typename... Args>
+    void PushOp(uint32_t op, C* object, bool (B::*do_func)(Args...), const std::decay_t<Args>&... args);
+
+    template<typename Memento = void, typename... Args>
+    void PushOp(uint32_t op, bool (*do_func)(Args...), const std::decay_t<Args>&... args);
+
+    // Create a compound History object on the Stack. See HISTORY_PUSH_COMPOUND.
+    // @param name: Label for debug purposes
+    // @param do_func: Delegate that created the record. Never called again - Redo replays the subrecords.
+    // @params args: Do function arguments to store.
+    template<typename... Args>
+    void PushCompound(const std::string& name, DelegateType<Args...>&& do_func, const std::decay_t<Args>&... args);
+
+    // Create a History object with an inline, typed memento on the Stack. See HISTORY_PUSH_MEMENTO.
+    // @params: See Push()
+    template<typename Memento, typename... Args>
+    void PushWithMemento(const std::string& name, DelegateType<Args...>&& do_func, DelegateType<Args...>&& undo_func, const std::decay_t<Args>&... args);
+
     // Use to remove the most recently created History object.
+    // A push nobody was notified of yet vanishes without a trace, otherwise subscribers get a Truncated change.
     void AbortPush();
 
+    // Thread-safe, lock-free. Queue a fully built History object for the owning thread.
+    // The object must have been created with this context as its parent.
+    // Ownership passes to the context, the object lands on the stack on the next DrainPending().
+    void Enqueue(History* record);
+
+    // Thread-safe, lock-free. Build a History object on the calling thread and queue it.
+    // @params: See Push()
+    template<typename... Args>
+    void Enqueue(const std::string& name, DelegateType<Args...>&& do_func, DelegateType<Args...>&& undo_func, const std::decay_t<Args>&... args);
+
+    // Owning thread only. Push all queued History objects in their enqueue order.
+    // Call at a safe point, i.e. not from within Do / Undo functions.
+    // @returns Number of objects pushed.
+    size_t DrainPending();
+
+    // Checks whether any History objects wait for DrainPending().
+    bool HasPending() const;
+
     // Bind delegate to fire when the stack changes.
-    void BindOnStackChanged(const std::function<void(int)>& func);
+    void BindOnStackChanged(const std::function<void(size_t)>& func);
 
     // Unbind delegate on stack changes
     void UnbindOnStackChanged();
 
+    // Add a listener for the structured changes of this stack. Any number may listen.
+    // Each operation delivers its changes as one batch, HistoryChangeBatch merges the batches of many.
+    // @returns ID for Unsubscribe()
+    size_t Subscribe(const HistoryChangeListener& listener);
+    void Unsubscribe(size_t subscription);
+
     // Wipe the stack.
     void Clear();
 
+    // Root context only. Start publishing a HistorySnapshot after every change of the stack.
+    // Removed records are then kept alive until no HistoryReadGuard can see them.
+    void EnableSnapshots();
+
+    // Checks whether snapshots are published for this context's stack.
+    bool SnapshotsEnabled() const;
+
+    // Publish a fresh snapshot now. Changes are normally published at the end of each operation.
+    // Collects only the top-level records pushed, undone or redone since the last snapshot, and shares the rest with it.
+    void PublishSnapshot();
+
 private:
     // Prepare the stack for a new object, deleting all operations above the Present.
     void PrePush();
 
+    // Fire change delegates and publish a snapshot if this is the root.
+    void NotifyStackChanged();
+
+    // Queue a change for the subscribers, if there are any.
+    void RecordChange(HistoryChangeKind kind, size_t first, size_t last, HistoryId id);
+
+    // Delete a record removed from the stack, or retire it if snapshot readers may still see it.
+    void DeleteRecord(History* record);
+
+    // Topmost context of this one.
+    HistoryContext* Root() const { return m_Root; }
+
+    // Add the record at idx to the root's ID index.
+    void Register(size_t idx);
+
+    // Put a new record on top of the stack and register it.
+    void Append(History* record);
+
+    // Create a HistoryOpRecordType and put it on top of the stack.
+    template<typename Record, typename... Params>
+    void PushOpRecord(uint32_t op, Params&&... params);
+
+    // Set / clear m_IsUndoing or m_IsRedoing, updating the root's m_RunState.
+    void SetRunFlag(std::atomic<bool>& flag, bool value);
+
+    // Whether this context or any parent is undoing / redoing. O(1) while nothing runs,
+    // and while it does for the nested contexts a Do / Undo function descends into one after another.
+    void GetRunFlags(bool& undoing, bool& redoing) const;
+
+    // Sentinel-only stack of a new context.
+    static HistoryStack NewStack();
+
+    // Queue an Undo() / Redo() for the worker pool.
+    std::future<bool> RunAsync(bool (HistoryContext::*op)());
+
+    // Worker side: run queued requests until none are left.
+    void DrainAsync();
+
+    // Snapshot entries of a root stack record and its subrecords, in Visit() order.
+    std::shared_ptr<const std::vector<HistorySnapshot::Entry>> CollectSnapshot(size_t idx) const;
+
     // The Undo stack.
-    std::vector<History*> m_HistoryStack = std::vector<History*>(1);
+    HistoryStack m_HistoryStack = NewStack();
 
     // Index to Present on the Stack.
-    int m_PresentHistoryIdx = 0;
+    size_t m_PresentHistoryIdx = 0;
 
     // If true, is currently in Undo or Redo. 
-    bool m_IsUndoing = false;
-    bool m_IsRedoing = false;
+    // Atomic, as worker threads query them while building records for Enqueue().
+    std::atomic<bool> m_IsUndoing = false;
+    std::atomic<bool> m_IsRedoing = false;
+
+    // Root only: Undo / Redo flags set anywhere in the tree, and a count of their changes.
+    // While no flag is set, IsUndoing() / IsRedoing() skip the walk up the parents: pushes cost O(1) at any nesting depth.
+    std::atomic<uint64_t> m_RunState = 0;
+
+    // Root only: unique among all roots ever created, so a cache keyed on it and m_RunState never mixes up trees.
+    uint64_t m_RunRootId = 0;
 
     // Context this object resides in.
     HistoryContext* m_ParentContext = nullptr;
 
+    // Topmost context and nesting level of this one.
+    HistoryContext* m_Root = nullptr;
+    int m_Depth = 0;
+
+    // ID -> location of every record in the tree. Root only, created on first push.
+    std::unique_ptr<HistoryIndex> m_Index;
+
     // Event delegates
-    std::function<void(int)> m_OnStackChanged;
+    std::function<void(size_t)> m_OnStackChanged;
+
+    // Subscribers and changes not delivered yet. Created on first Subscribe().
+    std::unique_ptr<HistoryChangeFeed> m_Feed;
 
     // Guard for preventing simultaneous Undo/Redo ops.
     std::mutex m_Mutex;
 
+    // Lock-free LIFO of records queued by Enqueue(), linked via History::m_PendingNext.
+    // DrainPending() takes the whole list at once and reverses it.
+    std::atomic<History*> m_PendingHead = nullptr;
+
+    // Published snapshots and retired records. Root only, created by EnableSnapshots().
+    std::unique_ptr<HistorySnapshotDomain> m_Snapshots;
+
+    // Request queue for UndoAsync() / RedoAsync(). Created on first use and published atomically,
+    // IsBusy() may poll it from any thread. Owned, deleted by the destructor.
+    std::atomic<HistoryAsyncState*> m_Async = nullptr;
+
+    // Pool for asynchronous requests, nullptr = default.
+    HistoryWorkerPool* m_WorkerPool = nullptr;
+
+    // Time-sliced operation in progress, if any. Blocks all other operations.
+    HistoryStepper* m_Stepper = nullptr;
+
+    // Per-thread Present of one context, so parallel subrecords of the same context don't fight over m_PresentHistoryIdx.
+    static thread_local const HistoryContext* s_CursorContext;
+    static thread_local size_t s_CursorIdx;
+
     template<typename... Args>
     friend struct HistoryWithParams;
     friend struct History;
     friend struct HistoryPushController;
     friend struct HistoryPopController;
+    friend struct HistoryReadGuard;
+    friend struct HistoryChangeBatch;
+    friend struct HistoryStepper;
+};
+
+// Holds back change events of a context until the outermost batch ends, then delivers them at once.
+// Wrap bursts of operations in one, e.g. a scripted edit or DrainPending() plus Undo()s.
+struct HistoryChangeBatch
+{
+    HistoryChangeBatch(HistoryContext& context);
+    ~HistoryChangeBatch();
+
+    HistoryChangeBatch(const HistoryChangeBatch&) = delete;
+    HistoryChangeBatch& operator=(const HistoryChangeBatch&) = delete;
+
+private:
+    HistoryContext& m_Context;
+};
+
+// Pins the latest snapshot of a root context for reading, from any thread.
+// Never blocks the writer; nothing visible through the snapshot is freed before the guard dies.
+// Keep guards short-lived - retired records pile up while an old snapshot is pinned.
+struct HistoryReadGuard
+{
+    HistoryReadGuard(const HistoryContext& root);
+    ~HistoryReadGuard();
+
+    HistoryReadGuard(const HistoryReadGuard&) = delete;
+    HistoryReadGuard& operator=(const HistoryReadGuard&) = delete;
+
+    const HistorySnapshot& operator*() const { return *m_Snapshot; }
+    const HistorySnapshot* operator->() const { return m_Snapshot; }
+
+private:
+    HistorySnapshotDomain* m_Domain = nullptr;
+    int m_Slot = -1;
+    const HistorySnapshot* m_Snapshot = nullptr;
+};
+
+// Time-sliced Undo / Redo, created by HistoryContext::BeginUndo() / BeginRedo().
+// Call Step() once per frame until it returns true. Other operations on the context are blocked meanwhile.
+// Destroying an unfinished stepper cancels it.
+struct HistoryStepper
+{
+    ~HistoryStepper();
+
+    HistoryStepper(const HistoryStepper&) = delete;
+    HistoryStepper& operator=(const HistoryStepper&) = delete;
+
+    // Process subrecords until the budget is spent. Always makes progress by at least one subrecord.
+    // @returns true once finished.
+    bool Step(std::chrono::microseconds budget = std::chrono::microseconds::max());
+
+    // Roll back everything processed so far, leaving the stack as if never started.
+    void Cancel();
+
+    bool IsFinished() const { return m_Finished; }
+    bool IsCancelled() const { return m_Cancelled; }
+    bool IsUndo() const { return m_Undo; }
+
+    // Number of subrecords processed / to process in total.
+    size_t GetDoneSteps() const { return m_Done.size(); }
+    size_t GetTotalSteps() const { return m_TotalSteps; }
+
+    // 0..1
+    float GetProgress() const { return m_TotalSteps ? float(m_Done.size()) / float(m_TotalSteps) : 1.f; }
+
+    // False if any Undo / Redo delegate failed.
+    bool Succeeded() const { return m_Result; }
+
+private:
+    HistoryStepper(HistoryContext& context, bool undo);
+
+    // Run the next subrecord. @returns false if there's nothing left.
+    bool Advance();
+
+    // Undo / Redo all subrecords of an independent compound object on the worker pool.
+    void RunParallel(History* record);
+
+    // Undo / Redo one record of a context and all of its compound subrecords, on the calling thread.
+    // Used by parallel tasks: touches no Present index but the thread's own cursor.
+    static bool RunRecord(HistoryContext* context, size_t idx, bool undo);
+
+    // Undo / Redo one non-compound record, timed when compiled with HISTORY_INSTRUMENTATION=1.
+    static bool RunTimed(History* record, bool undo);
+
+    // Close the innermost context if all its records are processed. @returns true if closed.
+    bool PopFinishedFrame();
+
+    // Start walking a context's records between first and last, in the stepper's direction.
+    void PushFrame(HistoryContext* context, size_t first, size_t last);
+
+    // Release the context.
+    void Finish();
+
+    // Records of one context left to process.
+    struct Frame
+    {
+        HistoryContext* context;
+        size_t next;
+        size_t last;
+    };
+
+    // Processed subrecord, for Cancel().
+    struct DoneStep
+    {
+        HistoryContext* context;
+        size_t idx;
+    };
+
+    HistoryContext& m_Context;
+    bool m_Undo;
+    bool m_Result = true;
+    bool m_Finished = false;
+    bool m_Cancelled = false;
+    size_t m_TotalSteps = 0;
+
+    // Independent compound objects run in parallel. Only for non-sliced operations.
+    bool m_Parallel = false;
+
+    std::vector<Frame> m_Frames;
+    std::vector<DoneStep> m_Done;
+
+    // Present indices before the stepper touched them, for Cancel().
+    std::vector<std::pair<HistoryContext*, size_t>> m_Cursors;
+
+    friend struct HistoryContext;
 };
 
 // History base class. Exists on the History (Undo) Stack.
@@ -141,13 +847,26 @@ struct History
     // Get topmost context.
     static HistoryContext* GetRootContext();
 
-    History(HistoryContext* parentContext, const std::string& name)
-        : m_Label(name)
-        , m_SubContext(parentContext)
+    History(HistoryContext* parentContext, uint32_t op)
+        : m_Op(op)
         , m_ID(NewID())
+        , m_SubContext(parentContext)
     {}
     virtual ~History() = default;
 
+    // Records come from HistoryPool.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr, size_t size);
+
+    // Memento of a record pushed by HISTORY_PUSH_MEMENTO. Asserts if the record holds a different type.
+    template<typename T>
+    T& Memento()
+    {
+        void* slot = GetMementoSlot(HistoryTypeTag<T>());
+        assert(slot && "Record holds no memento of this type, push it with HISTORY_PUSH_MEMENTO!");
+        return *static_cast<T*>(slot);
+    }
+
     // Save any kind of variable into this object
     // @param key: See HISTORY_KEY macro
     // @param value: Value to save
@@ -161,6 +880,12 @@ struct History
         if (m_SubContext.IsUndoingOrRedoing())
             return false;
 
+        HISTORY_ALLOCATION_SCOPE(Data);
+
+#if HISTORY_TRACING
+        HistoryTraceScope trace(HistoryTraceCategory::Save, key);
+#endif
+
         m_Data[key] = value;
         return true;
     }
@@ -179,11 +904,19 @@ struct History
         if (!m_SubContext.IsUndoingOrRedoing())
             return false;
 
-        std::string id = key;
+#if HISTORY_TRACING
+        HistoryTraceScope trace(HistoryTraceCategory::Load, key);
+#endif
+
+        std::string id;
+        {
+            HISTORY_ALLOCATION_SCOPE(KeyString);
+            id = key;
 
-        size_t it = id.find("_Undo");
-        if(it != std::string::npos)
-            id.erase(it);
+            size_t it = id.find("_Undo");
+            if(it != std::string::npos)
+                id.erase(it);
+        }
 
         if (m_Data.count(id) == 0)
             return false;
@@ -192,17 +925,45 @@ struct History
         return true;
     }
 
-    const auto& GetLabel() const { return m_Label; }
+    // Snapshot size bytes at data now. When the pushing Do function returns, only the 64-byte blocks it changed are kept.
+    // Do functions only, the buffer has to outlive the push. See HISTORY_SAVE_DIFF.
+    // @param key: See HISTORY_KEY macro
+    bool SaveDiff(const std::string& key, const void* data, size_t size);
+
+    // SaveDiff() without the snapshot: the buffer is write-protected until the Do function returns,
+    // and the first write to each page copies just that page. Cost follows the pages touched, not the buffer size.
+    // Linux only, elsewhere the same as SaveDiff(). See HISTORY_SAVE_PAGES.
+    bool SavePages(const std::string& key, void* data, size_t size);
+
+    // Write back the old contents of the blocks changed after SaveDiff(). Undo functions only.
+    // @returns true if a diff was saved under key
+    bool LoadDiff(const std::string& key, void* data);
+
+    const std::string& GetLabel() const { return m_Op == HistoryOps::Named ? GetName() : HistoryOps::Get(m_Op).label; }
+    uint32_t GetOp() const { return m_Op; }
     const auto& GetId() const { return m_ID; }
     const auto& GetSubcontext() const { return m_SubContext; }
 
+    // Compound objects only: subrecords don't depend on each other and may Undo / Redo in parallel.
+    // See HISTORY_INDEPENDENT
+    void MarkIndependent() { m_Independent = true; }
+    bool IsIndependent() const { return m_Independent; }
+
+    // Subrecords of an independent compound object sharing a conflict key keep their order. 0 = no conflicts.
+    // See HISTORY_CONFLICT_KEY
+    void SetConflictKey(size_t key) { m_ConflictKey = key ? key : 1; }
+    size_t GetConflictKey() const { return m_ConflictKey; }
+
 protected:
-    History() = default;
+    History()
+        : m_Op(HistoryOps::Named)
+    {}
 
-    static unsigned int NewID();
+    // Thread-safe.
+    static HistoryId NewID();
 
-    // Global context used by all functionalities. Set this before using History.
-    static HistoryContext* s_Context;
+    // Context used by all functionalities on this thread. Set this before using History.
+    static thread_local HistoryContext* s_Context;
 
     // Global lock
     static bool s_Lock;
@@ -211,21 +972,46 @@ protected:
     virtual bool Redo() = 0;
     virtual bool Undo() = 0;
 
+    // Memento storage if its type matches, else nullptr.
+    virtual void* GetMementoSlot(const void* /*type*/) { return nullptr; }
+
+    // Size of the record object, see HistoryContext::GetMemoryUsage().
+    virtual size_t GetRecordSize() const { return sizeof(History); }
+
+    // Label of a record outside HistoryOps, see HistoryOps::Named.
+    virtual const std::string& GetName() const;
+
+    // Fresh pending diff under key for SaveDiff() / SavePages(), nullptr if saving isn't allowed now.
+    HistoryBufferDiff* NewDiff(const std::string& key);
+
     // Everything stored via Save. All types of data go here.
     std::map<std::string, std::any> m_Data;
 
-    // Readable name
-    std::string m_Label;
+    // Index into HistoryOps: label and, for HISTORY_PUSH records, the functions. HistoryOps::Named for the others.
+    uint32_t m_Op;
 
     // Lookup ID
-    unsigned int m_ID;
+    HistoryId m_ID;
 
     // Holds History subobjects.
     HistoryContext m_SubContext;
 
+    // Intrusive link for HistoryContext's pending queue.
+    History* m_PendingNext = nullptr;
+
+    // Undo / Redo unwind / replay the subrecords instead of calling delegates. See HISTORY_PUSH_COMPOUND.
+    bool m_Compound = false;
+
+    // Compound subrecords may run in parallel.
+    bool m_Independent = false;
+
+    // Orders subrecords of an independent parent, 0 = none.
+    size_t m_ConflictKey = 0;
+
     friend struct HistoryContext;
     friend struct HistoryPushController;
     friend struct HistoryPopController;
+    friend struct HistoryStepper;
 };
 
 // Exact History implementation.
@@ -236,13 +1022,15 @@ struct HistoryWithParams : History
     constexpr static size_t TupleSize = std::tuple_size_v<TupleType>;
 
     HistoryWithParams(HistoryContext* parentContext, const std::string& name, DelegateType<Args...>&& d, DelegateType<Args...>&& ud, Args... args)
-        : History(parentContext, name)
+        : History(parentContext, HistoryOps::Named)
+        , m_Name(name)
         , m_DoFunc(d)
         , m_UndoFunc(ud)
         , m_Params(std::make_tuple(std::move(args)...))
     {
     }
 
+    std::string m_Name;
     TupleType m_Params;
     DelegateType<Args...> m_DoFunc;
     DelegateType<Args...> m_UndoFunc;
@@ -260,6 +1048,10 @@ protected:
         return Call(m_UndoFunc, std::make_index_sequence<TupleSize>());
     }
 
+    size_t GetRecordSize() const override { return sizeof(*this); }
+
+    const std::string& GetName() const override { return m_Name; }
+
     template<std::size_t... I>
     bool Call(const DelegateType<Args...>& func, const std::index_sequence<I...>& idxSeq)
     {
@@ -267,13 +1059,331 @@ protected:
     }
 };
 
+// History implementation with a typed memento living inline in the record.
+// The memento is value-initialized on push; Do writes it, Undo / Redo read it.
+template<typename Memento, typename... Args>
+struct HistoryWithMemento : HistoryWithParams<Args...>
+{
+    HistoryWithMemento(HistoryContext* parentContext, const std::string& name, DelegateType<Args...>&& d, DelegateType<Args...>&& ud, Args... args)
+        : HistoryWithParams<Args...>(parentContext, name, std::forward<DelegateType<Args...>>(d), std::forward<DelegateType<Args...>>(ud), args...)
+    {
+    }
+
+    Memento m_Memento{};
+
+protected:
+    void* GetMementoSlot(const void* type) override
+    {
+        return type == HistoryTypeTag<Memento>() ? &m_Memento : nullptr;
+    }
+
+    size_t GetRecordSize() const override { return sizeof(*this); }
+};
+
+// Record of a registered operation. The functions live in its HistoryOp,
+// the record only holds the object and the parameters. C = void for free functions.
+template<typename C, typename... Args>
+struct HistoryOpRecord : History
+{
+    using TupleType = std::tuple<std::decay_t<Args>...>;
+
+    HistoryOpRecord(HistoryContext* parentContext, uint32_t op, C* object, const std::decay_t<Args>&... args)
+        : History(parentContext, op)
+        , m_Object(object)
+        , m_Params(args...)
+    {
+    }
+
+    C* m_Object;
+    TupleType m_Params;
+
+protected:
+    bool Redo() override
+    {
+        return HistoryOps::Get(m_Op).redo(this);
+    }
+
+    bool Undo() override
+    {
+        return HistoryOps::Get(m_Op).undo(this);
+    }
+
+    size_t GetRecordSize() const override { return sizeof(*this); }
+};
+
+// Registered operation with a typed memento, see HistoryWithMemento.
+template<typename Memento, typename C, typename... Args>
+struct HistoryOpRecordWithMemento : HistoryOpRecord<C, Args...>
+{
+    using HistoryOpRecord<C, Args...>::HistoryOpRecord;
+
+    Memento m_Memento{};
+
+protected:
+    void* GetMementoSlot(const void* type) override
+    {
+        return type == HistoryTypeTag<Memento>() ? &m_Memento : nullptr;
+    }
+
+    size_t GetRecordSize() const override { return sizeof(*this); }
+};
+
+// Parameters packed back to back into a byte buffer, each at its own alignment.
+// Only for trivially copyable parameters: packing is a memcpy, nothing is constructed or destroyed.
+template<typename... Args>
+struct HistoryPackedLayout
+{
+    static constexpr bool Packable = ((std::is_trivially_copyable_v<std::decay_t<Args>> && alignof(std::decay_t<Args>) <= HistoryPool::Granularity) && ...);
+
+    // Offset of each parameter, then the end of the last one.
+    static constexpr std::array<size_t, sizeof...(Args) + 1> Offsets = []
+    {
+        constexpr size_t sizes[] = { sizeof(std::decay_t<Args>)..., 0 };
+        constexpr size_t alignments[] = { alignof(std::decay_t<Args>)..., 1 };
+
+        std::array<size_t, sizeof...(Args) + 1> offsets{};
+        size_t offset = 0;
+        for (size_t i = 0; i < sizeof...(Args); ++i)
+        {
+            offset = (offset + alignments[i] - 1) / alignments[i] * alignments[i];
+            offsets[i] = offset;
+            offset += sizes[i];
+        }
+
+        offsets[sizeof...(Args)] = offset;
+        return offsets;
+    }();
+
+    // Buffer size, rounded up to the size class: a multiple of HistoryPool::Granularity.
+    static constexpr size_t Size = Offsets[sizeof...(Args)] ? (Offsets[sizeof...(Args)] + HistoryPool::Granularity - 1) / HistoryPool::Granularity * HistoryPool::Granularity : HistoryPool::Granularity;
+
+    static void Pack(std::byte* buffer, const std::decay_t<Args>&... args)
+    {
+        Pack(buffer, std::index_sequence_for<Args...>(), args...);
+    }
+
+    // Call func with references to the packed parameters.
+    template<typename Func>
+    static bool Apply(std::byte* buffer, Func&& func)
+    {
+        return Apply(buffer, std::forward<Func>(func), std::index_sequence_for<Args...>());
+    }
+
+private:
+    template<size_t... I>
+    static void Pack([[maybe_unused]] std::byte* buffer, std::index_sequence<I...>, const std::decay_t<Args>&... args)
+    {
+        (std::memcpy(buffer + Offsets[I], std::addressof(args), sizeof(args)), ...);
+    }
+
+    template<typename Func, size_t... I>
+    static bool Apply([[maybe_unused]] std::byte* buffer, Func&& func, std::index_sequence<I...>)
+    {
+        return func(*std::launder(reinterpret_cast<std::decay_t<Args>*>(buffer + Offsets[I]))...);
+    }
+};
+
+// Record of a registered operation whose parameters are all trivially copyable: they are memcpy'd into an
+// inline buffer instead of a tuple. The type depends only on the buffer's size class, so such push sites
+// share one record class per size - and one HistoryPool bin.
+template<size_t Size>
+struct HistoryPackedRecord : History
+{
+    template<typename... Args>
+    HistoryPackedRecord(HistoryContext* parentContext, uint32_t op, void* object, const Args&... args)
+        : History(parentContext, op)
+        , m_Object(object)
+    {
+        static_assert(HistoryPackedLayout<Args...>::Size == Size, "Parameters don't fit this size class!");
+        HistoryPackedLayout<Args...>::Pack(m_Params, args...);
+    }
+
+    // C* of the push site, nullptr for free functions.
+    void* m_Object;
+    alignas(HistoryPool::Granularity) std::byte m_Params[Size];
+
+protected:
+    bool Redo() override
+    {
+        return HistoryOps::Get(m_Op).redo(this);
+    }
+
+    bool Undo() override
+    {
+        return HistoryOps::Get(m_Op).undo(this);
+    }
+
+    size_t GetRecordSize() const override { return sizeof(*this); }
+};
+
+// Packed record with a typed memento, see HistoryWithMemento. The memento needn't be trivially copyable.
+template<typename Memento, size_t Size>
+struct HistoryPackedRecordWithMemento : HistoryPackedRecord<Size>
+{
+    using HistoryPackedRecord<Size>::HistoryPackedRecord;
+
+    Memento m_Memento{};
+
+protected:
+    void* GetMementoSlot(const void* type) override
+    {
+        return type == HistoryTypeTag<Memento>() ? &m_Memento : nullptr;
+    }
+
+    size_t GetRecordSize() const override { return sizeof(*this); }
+};
+
+// Record type of a push site: packed if all parameters are trivially copyable.
+template<typename Memento, typename C, typename... Args>
+using HistoryOpRecordType = std::conditional_t<HistoryPackedLayout<Args...>::Packable,
+    std::conditional_t<std::is_void_v<Memento>, HistoryPackedRecord<HistoryPackedLayout<Args...>::Size>, HistoryPackedRecordWithMemento<Memento, HistoryPackedLayout<Args...>::Size>>,
+    std::conditional_t<std::is_void_v<Memento>, HistoryOpRecord<C, Args...>, HistoryOpRecordWithMemento<Memento, C, Args...>>>;
+
+// HistoryOp function calling Func with the object and parameters of a HistoryOpRecordType<Memento, C, Args...>.
+template<auto Func, typename C, typename... Args>
+bool HistoryCallOp(History* record)
+{
+    using Layout = HistoryPackedLayout<Args...>;
+    if constexpr (Layout::Packable)
+    {
+        auto* packed = static_cast<HistoryPackedRecord<Layout::Size>*>(record);
+        return Layout::Apply(packed->m_Params, [packed](auto&... params)
+        {
+            if constexpr (std::is_void_v<C>)
+                return Func(params...);
+            else
+                return (static_cast<C*>(packed->m_Object)->*Func)(params...);
+        });
+    }
+    else
+    {
+        auto* opRecord = static_cast<HistoryOpRecord<C, Args...>*>(record);
+        return std::apply([opRecord](auto&... params)
+        {
+            if constexpr (std::is_void_v<C>)
+                return Func(params...);
+            else
+                return (opRecord->m_Object->*Func)(params...);
+        }, opRecord->m_Params);
+    }
+}
+
+// Register a push site's member function pair. Undo = nullptr for compound records.
+// @param object, do_func: Only tell the types
+template<auto Do, auto Undo, typename C, typename B, typename... Args>
+uint32_t HistoryRegisterOp(const char* label, C* /*object*/, bool (B::* /*do_func*/)(Args...))
+{
+    if constexpr (std::is_null_pointer_v<decltype(Undo)>)
+        return HistoryOps::Register(label, &HistoryCallOp<Do, C, Args...>, nullptr);
+    else
+        return HistoryOps::Register(label, &HistoryCallOp<Do, C, Args...>, &HistoryCallOp<Undo, C, Args...>);
+}
+
+// Register a push site's free function pair.
+template<auto Do, auto Undo, typename... Args>
+uint32_t HistoryRegisterOp(const char* label, bool (* /*do_func*/)(Args...))
+{
+    return HistoryOps::Register(label, &HistoryCallOp<Do, void, Args...>, &HistoryCallOp<Undo, void, Args...>);
+}
+
+template<typename... Args>
+void HistoryContext::Enqueue(const std::string& name, DelegateType<Args...>&& do_func, DelegateType<Args...>&& undo_func, const std::decay_t<Args>&... args)
+{
+    Enqueue(new HistoryWithParams<Args...>(this, name, std::forward<DelegateType<Args...>>(do_func), std::forward<DelegateType<Args...>>(undo_func), args...));
+}
+
+template<typename Memento, typename... Args>
+void HistoryContext::PushWithMemento(const std::string& name, DelegateType<Args...>&& do_func, DelegateType<Args...>&& undo_func, const std::decay_t<Args>&... args)
+{
+    if (History::s_Lock)
+        return;
+
+    // May not push during undo/redo
+    if (IsUndoingOrRedoing())
+        return;
+
+    PrePush();
+
+    History* record;
+    {
+        HISTORY_ALLOCATION_SCOPE(Record);
+        record = new HistoryWithMemento<Memento, Args...>(this, name, std::forward<DelegateType<Args...>>(do_func), std::forward<DelegateType<Args...>>(undo_func), args...);
+    }
+
+    Append(record);
+}
+
+template<typename Record, typename... Params>
+void HistoryContext::PushOpRecord(uint32_t op, Params&&... params)
+{
+    if (History::s_Lock)
+        return;
+
+    // May not push during undo/redo
+    if (IsUndoingOrRedoing())
+        return;
+
+    PrePush();
+
+    History* record;
+    {
+        HISTORY_ALLOCATION_SCOPE(Record);
+        record = new Record(this, op, std::forward<Params>(params)...);
+    }
+
+    record->m_Compound = !HistoryOps::Get(op).undo;
+    Append(record);
+}
+
+template<typename Memento, typename C, typename B, typename... Args>
+void HistoryContext::PushOp(uint32_t op, C* object, bool (B::*)(Args...), const std::decay_t<Args>&... args)
+{
+    PushOpRecord<HistoryOpRecordType<Memento, C, Args...>>(op, object, args...);
+}
+
+template<typename Memento, typename... Args>
+void HistoryContext::PushOp(uint32_t op, bool (*)(Args...), const std::decay_t<Args>&... args)
+{
+    PushOpRecord<HistoryOpRecordType<Memento, void, Args...>>(op, static_cast<void*>(nullptr), args...);
+}
+
+template<typename... Args>
+void HistoryContext::PushCompound(const std::string& name, DelegateType<Args...>&& do_func, const std::decay_t<Args>&... args)
+{
+    if (History::s_Lock)
+        return;
+
+    // May not push during undo/redo
+    if (IsUndoingOrRedoing())
+        return;
+
+    PrePush();
+
+    History* record;
+    {
+        HISTORY_ALLOCATION_SCOPE(Record);
+        record = new HistoryWithParams<Args...>(this, name, std::forward<DelegateType<Args...>>(do_func), DelegateType<Args...>(), args...);
+    }
+
+    record->m_Compound = true;
+    Append(record);
+}
+
 // Manages current history stack.
 struct HistoryPushController
 {
     HistoryPushController();
     ~HistoryPushController();
 
+    // Leave the pushed record's subcontext now instead of at the end of the scope. See HISTORY_ABORT_PUSH.
+    // @param notify: false if AbortPush() follows and notifies instead.
+    void Pop(bool notify = true);
+
     bool active = true;
+
+private:
+    // Diffs pending when the record was pushed. Pop() finishes all newer ones. See HISTORY_SAVE_DIFF.
+    size_t m_DiffMark = 0;
 };
 
 struct HistoryPopController
@@ -292,9 +1402,25 @@ std::function<bool(Ts...)> hBindImpl(C* obj, bool(C::* func)(Ts...), std::index_
 template<typename C, typename... Ts, typename Indices = std::make_index_sequence<sizeof...(Ts)>>
 std::function<bool(Ts...)> hBind(C* obj, bool(C::* func)(Ts...))
 {
+    HISTORY_ALLOCATION_SCOPE(Delegate);
     return hBindImpl(obj, func, Indices());
 }
 
+// Member functions known at compile time. The delegate only holds obj, so it fits
+// into std::function's inline storage and binding doesn't allocate.
+template<auto Func, typename C, typename B, typename... Ts>
+std::function<bool(Ts...)> hBindMember(C* obj, bool(B::*)(Ts...))
+{
+    HISTORY_ALLOCATION_SCOPE(Delegate);
+    return [obj](Ts... args) { return (obj->*Func)(std::forward<Ts>(args)...); };
+}
+
+template<auto Func, typename C>
+auto hBind(C* obj)
+{
+    return hBindMember<Func>(obj, Func);
+}
+
 // Free functions
 template<typename... Ts, std::size_t... I>
 std::function<bool(Ts...)> hBindImpl(bool(*func)(Ts...), std::index_sequence<I...>)
@@ -305,31 +1431,72 @@ std::function<bool(Ts...)> hBindImpl(bool(*func)(Ts...), std::index_sequence<I..
 template<typename... Ts, typename Indices = std::make_index_sequence<sizeof...(Ts)>>
 std::function<bool(Ts...)> hBind(bool(*func)(Ts...))
 {
+    HISTORY_ALLOCATION_SCOPE(Delegate);
     return hBindImpl(func, Indices());
 }
 
 // Push a new History object onto the stack.
+// The site registers its function pair on first use, records then only store this and the parameters.
 // @param func: MEMBER Function name within which this is called.
 // @param ...: func's parameters to store as copies for later use.
 #define HISTORY_PUSH(func, ...) \
     assert(History::GetContext() && "You have to set history context first!"); \
-    History::GetContext()->Push(#func, hBind(this, &std::decay<decltype(*this)>::type::##func##), hBind(this, &std::decay<decltype(*this)>::type::##func##_Undo), __VA_ARGS__); \
+    static const uint32_t _historyOp = HistoryRegisterOp<&std::decay<decltype(*this)>::type::func, &std::decay<decltype(*this)>::type::func##_Undo>(#func, this, &std::decay<decltype(*this)>::type::func); \
+    History::GetContext()->PushOp(_historyOp, this, &std::decay<decltype(*this)>::type::func, __VA_ARGS__); \
 	HistoryPushController _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc;
 
 #define HISTORY_PUSH_FREE(func, ...) \
     assert(History::GetContext() && "You have to set history context first!"); \
-    History::GetContext()->Push(#func, hBind(func), hBind(func##_Undo), __VA_ARGS__); \
+    static const uint32_t _historyOp = HistoryRegisterOp<&func, &func##_Undo>(#func, &func); \
+    History::GetContext()->PushOp(_historyOp, &func, __VA_ARGS__); \
 	HistoryPushController _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc;
 
+// Push a new History object with a typed memento. No std::any, no heap allocation, no key strings.
+// @param func: MEMBER Function name within which this is called.
+// @param memento: Memento struct, read / written via HISTORY_MEMENTO(memento).
+// @param ...: func's parameters to store as copies for later use.
+#define HISTORY_PUSH_MEMENTO(func, memento, ...) \
+    assert(History::GetContext() && "You have to set history context first!"); \
+    static const uint32_t _historyOp = HistoryRegisterOp<&std::decay<decltype(*this)>::type::func, &std::decay<decltype(*this)>::type::func##_Undo>(#func, this, &std::decay<decltype(*this)>::type::func); \
+    History::GetContext()->PushOp<memento>(_historyOp, this, &std::decay<decltype(*this)>::type::func, __VA_ARGS__); \
+    HistoryPushController _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc;
+
+// Reference to the memento of the record being done / undone / redone.
+// Use after HISTORY_PUSH_MEMENTO in the Do function and after HISTORY_POP in the Undo function.
+#define HISTORY_MEMENTO(memento) \
+    (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->template Memento<memento>())
+
+// Push a compound History object: a function whose body only calls other History functions.
+// Undo unwinds its subrecords in reverse, Redo replays them - no func_Undo mirror needed.
+// Compound objects may be time-sliced with HistoryContext::BeginUndo() / BeginRedo().
+#define HISTORY_PUSH_COMPOUND(func, ...) \
+    assert(History::GetContext() && "You have to set history context first!"); \
+    static const uint32_t _historyOp = HistoryRegisterOp<&std::decay<decltype(*this)>::type::func, nullptr>(#func, this, &std::decay<decltype(*this)>::type::func); \
+    History::GetContext()->PushOp(_historyOp, this, &std::decay<decltype(*this)>::type::func, __VA_ARGS__); \
+    HistoryPushController _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc;
+
+// Call in a HISTORY_PUSH_COMPOUND function: its subrecords may Undo / Redo in parallel.
+// Their functions must then be safe to run concurrently, e.g. touch disjoint data.
+#define HISTORY_INDEPENDENT() \
+    (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->MarkIndependent())
+
+// Call in a subrecord's function of a HISTORY_INDEPENDENT parent: subrecords with equal keys don't run in parallel.
+#define HISTORY_CONFLICT_KEY(key) \
+    (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->SetConflictKey(std::hash<std::decay_t<decltype(key)>>()(key)))
+
 #define HISTORY_ABORT_PUSH() \
-    _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc.~HistoryPushController(); \
+    _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc.Pop(false); \
     History::GetContext()->AbortPush();
 
 #define HISTORY_POP() \
     HistoryPopController _use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc;
 
 // Creates variable key for History storage.
+#if HISTORY_ALLOCATION_TRACKING
+#define HISTORY_KEY(var) (HistoryAllocationScope(HistoryAllocationCategory::KeyString), std::string(#var)+"<-"+__FUNCTION__)
+#else
 #define HISTORY_KEY(var) std::string(#var)+"<-"+__FUNCTION__
+#endif
 
 // Save / Load macros
 // Limitation: Does not work with shadowing. One name = one variable.
@@ -348,6 +1515,14 @@ std::function<bool(Ts...)> hBind(bool(*func)(Ts...))
 #define HISTORY_SAVE3(v1, v2, v3) HISTORY_SAVE2(v1, v2) && HISTORY_SAVE_UNSAFE(v3)
 #define HISTORY_SAVE4(v1, v2, v3, v4) HISTORY_SAVE3(v1, v2, v3) && HISTORY_SAVE_UNSAFE(v4);
 
+// Snapshot a large flat buffer, e.g. pixels or vertices, in a Do function. Once it returns, only the changed blocks are kept.
+// Restore them in the Undo function with HISTORY_LOAD_DIFF(ptr) - same ptr expression. Redo calls the Do function again.
+#define HISTORY_SAVE_DIFF(ptr, size) (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->SaveDiff(HISTORY_KEY(ptr), ptr, size))
+// HISTORY_SAVE_DIFF catching writes page by page instead of snapshotting, for huge buffers with sparse changes.
+// Only this thread may write the buffer until the Do function returns. Restore with HISTORY_LOAD_DIFF(ptr).
+#define HISTORY_SAVE_PAGES(ptr, size) (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->SavePages(HISTORY_KEY(ptr), ptr, size))
+#define HISTORY_LOAD_DIFF(ptr) (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->LoadDiff(HISTORY_KEY(ptr), ptr))
+
 #define HISTORY_LOAD(var, ...) (_use_HISTORY_PUSH_for_DoFunc_or_HISTORY_POP_for_UndoFunc, History::GetContext()->ParentContext()->Present()->Load(HISTORY_KEY(var), var, __VA_ARGS__))
 #define HISTORY_LOAD2(v1, v2, ...) (HISTORY_LOAD(v1, __VA_ARGS__) && HISTORY_LOAD(v2, __VA_ARGS__))
 #define HISTORY_LOAD3(v1, v2, v3, ...) (HISTORY_LOAD2(v1, v2, __VA_ARGS__) && HISTORY_LOAD(v3, __VA_ARGS__))
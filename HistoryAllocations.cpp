@@ -0,0 +1,117 @@
+#include "HistoryAllocations.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> s_Counts[size_t(HistoryAllocationCategory::Count)];
+    std::atomic<uint64_t> s_Bytes[size_t(HistoryAllocationCategory::Count)];
+}
+
+uint64_t HistoryAllocationCounts::HistoryCount() const
+{
+    uint64_t result = 0;
+    for (size_t i = size_t(HistoryAllocationCategory::Other) + 1; i < size_t(HistoryAllocationCategory::Count); ++i)
+        result += count[i];
+
+    return result;
+}
+
+HistoryAllocationCounts HistoryAllocations::Get()
+{
+    HistoryAllocationCounts result;
+    for (size_t i = 0; i < size_t(HistoryAllocationCategory::Count); ++i)
+    {
+        result.count[i] = s_Counts[i].load(std::memory_order_relaxed);
+        result.bytes[i] = s_Bytes[i].load(std::memory_order_relaxed);
+    }
+
+    return result;
+}
+
+void HistoryAllocations::Reset()
+{
+    for (size_t i = 0; i < size_t(HistoryAllocationCategory::Count); ++i)
+    {
+        s_Counts[i].store(0, std::memory_order_relaxed);
+        s_Bytes[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+std::string HistoryAllocations::Dump()
+{
+    static const char* s_CategoryNames[] = { "Other", "Record", "Delegate", "KeyString", "Data", "SubContext", "Index" };
+
+    const auto counts = Get();
+
+    std::string result;
+    for (size_t i = 0; i < size_t(HistoryAllocationCategory::Count); ++i)
+    {
+        if (!counts.count[i])
+            continue;
+
+        char line[128];
+        std::snprintf(line, sizeof(line), "%s\t%llu allocations\t%llu bytes\n", s_CategoryNames[i],
+            (unsigned long long)counts.count[i], (unsigned long long)counts.bytes[i]);
+        result += line;
+    }
+
+    return result;
+}
+
+void HistoryAllocations::Count(size_t bytes)
+{
+    const size_t category = size_t(s_Category);
+    s_Counts[category].fetch_add(1, std::memory_order_relaxed);
+    s_Bytes[category].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+#if HISTORY_ALLOCATION_TRACKING
+
+void* operator new(size_t size)
+{
+    HistoryAllocations::Count(size);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    HistoryAllocations::Count(size);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#endif
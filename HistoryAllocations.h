@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 1 = count heap allocations by History operation. Replaces the global operator new / delete
+// in HistoryAllocations.cpp, so define it for every translation unit, or none.
+#ifndef HISTORY_ALLOCATION_TRACKING
+#define HISTORY_ALLOCATION_TRACKING 0
+#endif
+
+// What a heap allocation was made for.
+enum class HistoryAllocationCategory : uint8_t
+{
+    Other,          // Outside of History, e.g. the Do / Undo functions themselves
+    Record,         // History objects, their labels and stored parameters
+    Delegate,       // Do / Undo delegates, see hBind()
+    KeyString,      // HISTORY_KEY strings of HISTORY_SAVE / HISTORY_LOAD
+    Data,           // m_Data nodes and mementos
+    SubContext,     // History stacks of (sub)contexts
+    Index,          // Lookup by ID, see HistoryContext::Find()
+    Count
+};
+
+// Heap allocations since the last HistoryAllocations::Reset(), per category.
+struct HistoryAllocationCounts
+{
+    uint64_t count[size_t(HistoryAllocationCategory::Count)] = {};
+    uint64_t bytes[size_t(HistoryAllocationCategory::Count)] = {};
+
+    // Everything but HistoryAllocationCategory::Other.
+    uint64_t HistoryCount() const;
+};
+
+// Global heap allocation counters, filled when compiled with HISTORY_ALLOCATION_TRACKING=1.
+// Allocations are attributed to the innermost HistoryAllocationScope of the allocating thread.
+struct HistoryAllocations
+{
+    static bool IsTracking() { return HISTORY_ALLOCATION_TRACKING != 0; }
+
+    static HistoryAllocationCounts Get();
+    static void Reset();
+
+    // One line per category with allocations.
+    static std::string Dump();
+
+    // Called by the replaced operator new.
+    static void Count(size_t bytes);
+
+    // Category of this thread's allocations.
+    static inline thread_local HistoryAllocationCategory s_Category = HistoryAllocationCategory::Other;
+};
+
+// Attributes this thread's allocations to a category until the end of the scope.
+struct HistoryAllocationScope
+{
+    HistoryAllocationScope(HistoryAllocationCategory category)
+        : m_Previous(HistoryAllocations::s_Category)
+    {
+        HistoryAllocations::s_Category = category;
+    }
+
+    ~HistoryAllocationScope()
+    {
+        HistoryAllocations::s_Category = m_Previous;
+    }
+
+    HistoryAllocationScope(const HistoryAllocationScope&) = delete;
+    HistoryAllocationScope& operator=(const HistoryAllocationScope&) = delete;
+
+private:
+    HistoryAllocationCategory m_Previous;
+};
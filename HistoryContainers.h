@@ -0,0 +1,326 @@
+#pragma once
+#include "History.h"
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Containers recording their own changes in History::GetContext().
+// Every mutating member is a Do function of its own: it pushes one small record holding just the diff -
+// the index / key, the new value and, for overwrites and erasures, the old value as a typed memento.
+// No Do / Undo pairs to write, no copies of the whole container.
+//
+// Use them at the top level or in HISTORY_PUSH_COMPOUND functions, which unwind / replay the records by themselves.
+// Called from a plain HISTORY_PUSH function, they nest like any other Do function:
+// its Undo function then has to call the matching func_Undo mirrors, newest first.
+// Mutating members called during Undo / Redo change the container without recording.
+
+// std::vector with recorded changes.
+template<typename T, typename Vector = std::vector<T>>
+struct HistoryVector
+{
+    using Value = T;
+
+    HistoryVector() = default;
+    HistoryVector(Vector items) : m_Items(std::move(items)) {}
+
+    const Vector& Get() const { return m_Items; }
+    size_t GetSize() const { return m_Items.size(); }
+    bool IsEmpty() const { return m_Items.empty(); }
+    const T& operator[](size_t index) const { return m_Items[index]; }
+    auto begin() const { return m_Items.begin(); }
+    auto end() const { return m_Items.end(); }
+
+    bool PushBack(const T& value)
+    {
+        HISTORY_PUSH(PushBack, value);
+        m_Items.push_back(value);
+        return true;
+    }
+
+    bool PushBack_Undo(const T&)
+    {
+        HISTORY_POP();
+        m_Items.pop_back();
+        return true;
+    }
+
+    bool PopBack()
+    {
+        return !m_Items.empty() && Erase(m_Items.size() - 1);
+    }
+
+    bool Insert(size_t index, const T& value)
+    {
+        if (index > m_Items.size())
+            return false;
+
+        HISTORY_PUSH(Insert, index, value);
+        m_Items.insert(m_Items.begin() + index, value);
+        return true;
+    }
+
+    bool Insert_Undo(size_t index, const T&)
+    {
+        HISTORY_POP();
+        m_Items.erase(m_Items.begin() + index);
+        return true;
+    }
+
+    // Overwrite one item. Records the old one.
+    bool Set(size_t index, const T& value)
+    {
+        if (index >= m_Items.size())
+            return false;
+
+        HISTORY_PUSH_MEMENTO(Set, Value, index, value);
+        HISTORY_MEMENTO(Value) = std::move(m_Items[index]);
+        m_Items[index] = value;
+        return true;
+    }
+
+    bool Set_Undo(size_t index, const T&)
+    {
+        HISTORY_POP();
+        m_Items[index] = std::move(HISTORY_MEMENTO(Value));
+        return true;
+    }
+
+    bool Erase(size_t index)
+    {
+        if (index >= m_Items.size())
+            return false;
+
+        HISTORY_PUSH_MEMENTO(Erase, Value, index);
+        HISTORY_MEMENTO(Value) = std::move(m_Items[index]);
+        m_Items.erase(m_Items.begin() + index);
+        return true;
+    }
+
+    bool Erase_Undo(size_t index)
+    {
+        HISTORY_POP();
+        m_Items.insert(m_Items.begin() + index, std::move(HISTORY_MEMENTO(Value)));
+        return true;
+    }
+
+    // Replace all items. Records both the old and the new contents.
+    bool Assign(const Vector& items)
+    {
+        HISTORY_PUSH_MEMENTO(Assign, Vector, items);
+        HISTORY_MEMENTO(Vector) = std::move(m_Items);
+        m_Items = items;
+        return true;
+    }
+
+    bool Assign_Undo(const Vector&)
+    {
+        HISTORY_POP();
+        m_Items = std::move(HISTORY_MEMENTO(Vector));
+        return true;
+    }
+
+    bool Clear()
+    {
+        return !m_Items.empty() && Assign({});
+    }
+
+private:
+    Vector m_Items;
+};
+
+// std::map with recorded changes. Map may be any map type with the std::map interface, e.g. std::unordered_map.
+template<typename Key, typename T, typename Map = std::map<Key, T>>
+struct HistoryMap
+{
+    using Value = T;
+
+    // Memento of Set: the overwritten value, if there was one.
+    struct SetMemento
+    {
+        Value oldValue;
+        bool existed;
+    };
+
+    HistoryMap() = default;
+    HistoryMap(Map items) : m_Items(std::move(items)) {}
+
+    const Map& Get() const { return m_Items; }
+    size_t GetSize() const { return m_Items.size(); }
+    bool IsEmpty() const { return m_Items.empty(); }
+    bool Contains(const Key& key) const { return m_Items.find(key) != m_Items.end(); }
+    const T& At(const Key& key) const { return m_Items.at(key); }
+    auto begin() const { return m_Items.begin(); }
+    auto end() const { return m_Items.end(); }
+
+    // Add a new key. @returns false if it exists already
+    bool Insert(const Key& key, const T& value)
+    {
+        if (Contains(key))
+            return false;
+
+        HISTORY_PUSH(Insert, key, value);
+        m_Items.emplace(key, value);
+        return true;
+    }
+
+    bool Insert_Undo(const Key& key, const T&)
+    {
+        HISTORY_POP();
+        m_Items.erase(key);
+        return true;
+    }
+
+    // Add or overwrite a key. Records the overwritten value.
+    bool Set(const Key& key, const T& value)
+    {
+        HISTORY_PUSH_MEMENTO(Set, SetMemento, key, value);
+
+        auto it = m_Items.find(key);
+        auto& memento = HISTORY_MEMENTO(SetMemento);
+        memento.existed = it != m_Items.end();
+        if (memento.existed)
+        {
+            memento.oldValue = std::move(it->second);
+            it->second = value;
+        }
+        else
+        {
+            m_Items.emplace(key, value);
+        }
+
+        return true;
+    }
+
+    bool Set_Undo(const Key& key, const T&)
+    {
+        HISTORY_POP();
+
+        auto& memento = HISTORY_MEMENTO(SetMemento);
+        if (memento.existed)
+            m_Items[key] = std::move(memento.oldValue);
+        else
+            m_Items.erase(key);
+
+        return true;
+    }
+
+    // Remove a key. Records its value. @returns false if there is no such key
+    bool Erase(const Key& key)
+    {
+        auto it = m_Items.find(key);
+        if (it == m_Items.end())
+            return false;
+
+        HISTORY_PUSH_MEMENTO(Erase, Value, key);
+        HISTORY_MEMENTO(Value) = std::move(it->second);
+        m_Items.erase(it);
+        return true;
+    }
+
+    bool Erase_Undo(const Key& key)
+    {
+        HISTORY_POP();
+        m_Items.emplace(key, std::move(HISTORY_MEMENTO(Value)));
+        return true;
+    }
+
+    // Replace all items. Records both the old and the new contents.
+    bool Assign(const Map& items)
+    {
+        HISTORY_PUSH_MEMENTO(Assign, Map, items);
+        HISTORY_MEMENTO(Map) = std::move(m_Items);
+        m_Items = items;
+        return true;
+    }
+
+    bool Assign_Undo(const Map&)
+    {
+        HISTORY_POP();
+        m_Items = std::move(HISTORY_MEMENTO(Map));
+        return true;
+    }
+
+    bool Clear()
+    {
+        return !m_Items.empty() && Assign({});
+    }
+
+private:
+    Map m_Items;
+};
+
+// std::set with recorded changes. Records are just the key, nothing is lost by an erasure.
+template<typename Key, typename Set = std::set<Key>>
+struct HistorySet
+{
+    HistorySet() = default;
+    HistorySet(Set items) : m_Items(std::move(items)) {}
+
+    const Set& Get() const { return m_Items; }
+    size_t GetSize() const { return m_Items.size(); }
+    bool IsEmpty() const { return m_Items.empty(); }
+    bool Contains(const Key& key) const { return m_Items.find(key) != m_Items.end(); }
+    auto begin() const { return m_Items.begin(); }
+    auto end() const { return m_Items.end(); }
+
+    // @returns false if the key exists already
+    bool Insert(const Key& key)
+    {
+        if (Contains(key))
+            return false;
+
+        HISTORY_PUSH(Insert, key);
+        m_Items.insert(key);
+        return true;
+    }
+
+    bool Insert_Undo(const Key& key)
+    {
+        HISTORY_POP();
+        m_Items.erase(key);
+        return true;
+    }
+
+    // @returns false if there is no such key
+    bool Erase(const Key& key)
+    {
+        if (!Contains(key))
+            return false;
+
+        HISTORY_PUSH(Erase, key);
+        m_Items.erase(key);
+        return true;
+    }
+
+    bool Erase_Undo(const Key& key)
+    {
+        HISTORY_POP();
+        m_Items.insert(key);
+        return true;
+    }
+
+    // Replace all items. Records both the old and the new contents.
+    bool Assign(const Set& items)
+    {
+        HISTORY_PUSH_MEMENTO(Assign, Set, items);
+        HISTORY_MEMENTO(Set) = std::move(m_Items);
+        m_Items = items;
+        return true;
+    }
+
+    bool Assign_Undo(const Set&)
+    {
+        HISTORY_POP();
+        m_Items = std::move(HISTORY_MEMENTO(Set));
+        return true;
+    }
+
+    bool Clear()
+    {
+        return !m_Items.empty() && Assign({});
+    }
+
+private:
+    Set m_Items;
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "HistoryPages.h"
+
+// Compare kernel: AVX2 if the compiler targets it, else SSE2 (always there on x64), else portable 64-bit words.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HISTORY_DIFF_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HISTORY_DIFF_SSE2 1
+#endif
+
+// Checks whether two 64-byte blocks are equal.
+inline bool HistoryBlocksEqual(const std::byte* a, const std::byte* b)
+{
+#if defined(HISTORY_DIFF_AVX2)
+    const __m256i lo = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b)));
+    const __m256i hi = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + 32)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + 32)));
+    return _mm256_movemask_epi8(_mm256_and_si256(lo, hi)) == -1;
+#elif defined(HISTORY_DIFF_SSE2)
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+    for (size_t i = 16; i < 64; i += 16)
+        equal = _mm_and_si128(equal, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+
+    return _mm_movemask_epi8(equal) == 0xFFFF;
+#else
+    uint64_t difference = 0;
+    for (size_t i = 0; i < 64; i += 8)
+    {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        difference |= x ^ y;
+    }
+
+    return !difference;
+#endif
+}
+
+// Changed parts of a buffer: the old contents of every 64-byte block that differs between two points in time.
+// Begin() takes the before image, Finish() compares it with the buffer and keeps only the changed blocks,
+// coalesced into runs. Restore() writes them back. See HISTORY_SAVE_DIFF.
+// BeginPages() instead catches the written pages as they are touched, see HistoryPageTracker and HISTORY_SAVE_PAGES.
+struct HistoryBufferDiff
+{
+    static constexpr size_t BlockSize = 64;
+
+    // Snapshot the buffer. It has to stay valid until Finish().
+    void Begin(const void* data, size_t size)
+    {
+        m_Source = data;
+        m_Size = size;
+        m_Runs.clear();
+        m_Bytes.clear();
+
+        // Reuse the thread's last snapshot: big buffers then don't fault in fresh pages on every push.
+        m_Snapshot.swap(Spare());
+        if (m_Snapshot.size() < size)
+            m_Snapshot.resize(size);
+
+        if (size)
+            std::memcpy(m_Snapshot.data(), data, size);
+    }
+
+    // Write-protect the buffer instead of copying it: Finish() keeps the old contents of every page written meanwhile.
+    // Falls back to Begin() where page tracking isn't available.
+    void BeginPages(void* data, size_t size)
+    {
+#if HISTORY_PAGE_TRACKING
+        m_Runs.clear();
+        m_Bytes.clear();
+
+        auto tracker = std::make_shared<HistoryPageTracker>();
+        if (tracker->Begin(data, size))
+        {
+            m_Source = data;
+            m_Size = size;
+            m_Pages = std::move(tracker);
+            return;
+        }
+#endif
+        Begin(data, size);
+    }
+
+    // Keep the blocks changed since Begin(), drop the snapshot.
+    void Finish()
+    {
+        if (!m_Source)
+            return;
+
+#if HISTORY_PAGE_TRACKING
+        if (m_Pages)
+        {
+            // Pages come in address order: adjacent ones join one run.
+            m_Pages->Finish([this](size_t offset, const std::byte* bytes, size_t size)
+            {
+                if (!m_Runs.empty() && m_Runs.back().offset + m_Runs.back().size == offset)
+                    m_Runs.back().size += size;
+                else
+                    m_Runs.push_back({ offset, size });
+
+                m_Bytes.insert(m_Bytes.end(), bytes, bytes + size);
+            });
+
+            m_Pages.reset();
+            m_Source = nullptr;
+            return;
+        }
+#endif
+
+        const auto* before = m_Snapshot.data();
+        const auto* after = static_cast<const std::byte*>(m_Source);
+
+        size_t runStart = m_Size;
+        for (size_t offset = 0; offset < m_Size; offset += BlockSize)
+        {
+            const size_t size = std::min(BlockSize, m_Size - offset);
+            const bool changed = size == BlockSize ? !HistoryBlocksEqual(before + offset, after + offset) : std::memcmp(before + offset, after + offset, size) != 0;
+
+            if (changed && runStart == m_Size)
+            {
+                runStart = offset;
+            }
+            else if (!changed && runStart != m_Size)
+            {
+                AddRun(runStart, offset);
+                runStart = m_Size;
+            }
+        }
+
+        if (runStart != m_Size)
+            AddRun(runStart, m_Size);
+
+        if (m_Snapshot.size() > Spare().size())
+            Spare().swap(m_Snapshot);
+
+        std::vector<std::byte>().swap(m_Snapshot);
+        m_Source = nullptr;
+    }
+
+    // Write the old contents of the changed blocks back.
+    void Restore(void* data) const
+    {
+        auto* target = static_cast<std::byte*>(data);
+        const std::byte* bytes = m_Bytes.data();
+        for (const Run& run : m_Runs)
+        {
+            std::memcpy(target + run.offset, bytes, run.size);
+            bytes += run.size;
+        }
+    }
+
+    // Between Begin() and Finish().
+    bool IsPending() const { return m_Source != nullptr; }
+
+    // Bytes of the buffer / kept after Finish().
+    size_t GetSize() const { return m_Size; }
+    size_t GetChangedBytes() const { return m_Bytes.size(); }
+
+private:
+    struct Run
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    void AddRun(size_t begin, size_t end)
+    {
+        m_Runs.push_back({ begin, end - begin });
+        m_Bytes.insert(m_Bytes.end(), m_Snapshot.data() + begin, m_Snapshot.data() + end);
+    }
+
+    static std::vector<std::byte>& Spare()
+    {
+        static thread_local std::vector<std::byte> s_Spare;
+        return s_Spare;
+    }
+
+    const void* m_Source = nullptr;
+    size_t m_Size = 0;
+
+    // Before image, until Finish().
+    std::vector<std::byte> m_Snapshot;
+
+#if HISTORY_PAGE_TRACKING
+    // Instead of m_Snapshot after BeginPages(), until Finish(). Shared only to keep std::any happy.
+    std::shared_ptr<HistoryPageTracker> m_Pages;
+#endif
+
+    // Changed block runs, their old bytes back to back in m_Bytes.
+    std::vector<Run> m_Runs;
+    std::vector<std::byte> m_Bytes;
+};
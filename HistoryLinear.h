@@ -0,0 +1,423 @@
+#pragma once
+#include "HistoryLog.h"
+#include <tuple>
+
+// Payload of a HistoryLinearContext record: object and parameters of a member function pair.
+template<typename C, typename... Args>
+struct HistoryLinearRecord
+{
+    HistoryLinearRecord(C* object, const std::decay_t<Args>&... args)
+        : m_Object(object)
+        , m_Params(args...)
+    {
+    }
+
+    C* m_Object;
+    std::tuple<std::decay_t<Args>...> m_Params;
+};
+
+// Record with a typed memento, see HISTORY_LINEAR_PUSH_MEMENTO.
+template<typename Memento, typename C, typename... Args>
+struct HistoryLinearRecordWithMemento : HistoryLinearRecord<C, Args...>
+{
+    using HistoryLinearRecord<C, Args...>::HistoryLinearRecord;
+
+    Memento m_Memento{};
+};
+
+// HistoryOps functions of a HistoryLinearContext record type. Undo = nullptr for compound records.
+template<typename Record, auto Do, auto Undo, typename Memento>
+struct HistoryLinearOp
+{
+    static bool Redo(void*, void* payload) { return Call<Do>(payload); }
+    static bool UndoPayload(void*, void* payload) { return Call<Undo>(payload); }
+    static void Destroy(void* payload) { static_cast<Record*>(payload)->~Record(); }
+
+    static void Relocate(void* to, void* from)
+    {
+        new (to) Record(std::move(*static_cast<Record*>(from)));
+        Destroy(from);
+    }
+
+    static void* MementoPayload(void* payload, const void* type)
+    {
+        if constexpr (std::is_void_v<Memento>)
+            return nullptr;
+        else
+            return type == HistoryTypeTag<Memento>() ? &static_cast<Record*>(payload)->m_Memento : nullptr;
+    }
+
+    static HistoryOp Describe(const char* label)
+    {
+        HistoryOp op;
+        op.label = label;
+        op.redoPayload = &Redo;
+        if constexpr (!std::is_null_pointer_v<decltype(Undo)>)
+            op.undoPayload = &UndoPayload;
+        if constexpr (!std::is_trivially_copyable_v<Record>)
+        {
+            op.destroyPayload = &Destroy;
+            op.relocatePayload = &Relocate;
+        }
+        op.mementoPayload = &MementoPayload;
+        return op;
+    }
+
+private:
+    template<auto Func>
+    static bool Call(void* payload)
+    {
+        auto* record = static_cast<Record*>(payload);
+        return std::apply([record](auto&... params) { return (record->m_Object->*Func)(params...); }, record->m_Params);
+    }
+};
+
+// Payload type of a push site.
+template<typename Memento, typename C, typename... Args>
+using HistoryLinearRecordType = std::conditional_t<std::is_void_v<Memento>, HistoryLinearRecord<C, Args...>, HistoryLinearRecordWithMemento<Memento, C, Args...>>;
+
+// Register a push site's member function pair. Undo = nullptr for compound records.
+// @param object, do_func: Only tell the types
+template<typename Memento, auto Do, auto Undo, typename C, typename B, typename... Args>
+uint32_t HistoryRegisterLinearOp(const char* label, C* /*object*/, bool (B::* /*do_func*/)(Args...))
+{
+    return HistoryOps::Register(HistoryLinearOp<HistoryLinearRecordType<Memento, C, Args...>, Do, Undo, Memento>::Describe(label));
+}
+
+// History engine mode storing the whole nested tree as one linear sequence: an Euler tour through a HistoryByteLog.
+// Every record is an enter entry holding its parameters, followed by its nested records and an exit marker.
+// Both link to each other, so siblings are one hop apart in either direction.
+//
+// Functions are written as for HistoryContext, with the HISTORY_LINEAR_* macros: Do pushes, Undo pops and
+// unwinds its nested records by calling their Undo functions, Redo calls Do again.
+// Instead of retargeting a context per level, the macros move cursors over the sequence - no per-level stacks.
+// Compound records unwind as a reverse scan over their range and replay as a forward scan.
+struct HistoryLinearContext
+{
+    // @param capacity: Initial size of the log in bytes. It doubles whenever full.
+    explicit HistoryLinearContext(size_t capacity = 64 * 1024)
+        : m_Log(capacity)
+    {
+    }
+
+    // Context used by the HISTORY_LINEAR_* macros on this thread.
+    static HistoryLinearContext* GetContext() { return s_Context; }
+    static void SetContext(HistoryLinearContext* context) { s_Context = context; }
+
+    // Ctrl+Z / Ctrl+Y
+    bool Undo()
+    {
+        if (!CanUndo())
+            return false;
+
+        const size_t root = m_PresentOffset - m_Roots.GetBytes(m_PresentIdx - 1);
+
+        m_IsUndoing = true;
+        m_Frames.push_back({ None, None, root });
+        const bool result = RunEntry(root, true);
+        m_Frames.pop_back();
+        m_IsUndoing = false;
+
+        --m_PresentIdx;
+        m_PresentOffset = root;
+        m_PresentRecords -= m_Roots.GetRecords(m_PresentIdx);
+        return result;
+    }
+
+    bool Redo()
+    {
+        if (!CanRedo())
+            return false;
+
+        const size_t root = m_PresentOffset;
+
+        m_IsRedoing = true;
+        m_Frames.push_back({ None, None, root });
+        const bool result = RunEntry(root, false);
+        m_Frames.pop_back();
+        m_IsRedoing = false;
+
+        m_PresentOffset += m_Roots.GetBytes(m_PresentIdx);
+        m_PresentRecords += m_Roots.GetRecords(m_PresentIdx);
+        ++m_PresentIdx;
+        return result;
+    }
+
+    bool CanUndo() const { return m_Frames.empty() && m_PresentIdx > 0; }
+    bool CanRedo() const { return m_Frames.empty() && m_PresentIdx < m_Roots.GetSize(); }
+
+    bool IsUndoing() const { return m_IsUndoing; }
+    bool IsRedoing() const { return m_IsRedoing; }
+    bool IsUndoingOrRedoing() const { return m_IsUndoing || m_IsRedoing; }
+
+    // Wipe the stack. Keeps the log's memory.
+    void Clear()
+    {
+        assert(m_Frames.empty() && "May not clear from within a History function!");
+        m_Log.Truncate(0);
+        m_Roots.Clear();
+        m_PresentIdx = 0;
+        m_PresentOffset = 0;
+        m_PresentRecords = 0;
+        m_RecordCount = 0;
+    }
+
+    // Top-level records, done ones first.
+    size_t GetSize() const { return m_Roots.GetSize(); }
+
+    // Number of done top-level records.
+    size_t GetPresentIdx() const { return m_PresentIdx; }
+
+    // All records including nested ones.
+    size_t GetRecordCount() const { return m_RecordCount; }
+
+    // Bytes used / allocated by the log.
+    size_t GetByteSize() const { return m_Log.GetUsed(); }
+    size_t GetCapacity() const { return m_Log.GetCapacity(); }
+
+    // Bytes allocated for the top-level record list.
+    size_t GetRootCapacity() const { return m_Roots.GetCapacity(); }
+
+    // Macro interface. See HISTORY_LINEAR_PUSH.
+    // Do: append an enter entry. Redo: step onto the matching recorded one. Undo: nothing to do.
+    // @returns true if the caller's HistoryLinearScope has to Close()
+    template<typename Memento = void, typename C, typename B, typename... Args>
+    bool PushOp(uint32_t op, C* object, bool (B::*)(Args...), const std::decay_t<Args>&... args)
+    {
+        if (m_IsUndoing)
+            return false;
+
+        if (m_IsRedoing)
+        {
+            const size_t entry = Step(true);
+            assert(m_Log.Header(entry).op == op && "Redo pushes differ from Do!");
+            (void)op;
+            m_Frames.push_back({ entry, Exit(entry), FirstChild(entry) });
+            return true;
+        }
+
+        if (m_Frames.empty())
+            DropRedos();
+
+        using Record = HistoryLinearRecordType<Memento, C, Args...>;
+        const size_t entry = m_Log.Append(sizeof(Record));
+        m_Log.Emplace<Record>(entry, op, object, args...);
+        ++m_RecordCount;
+
+        m_Frames.push_back({ entry, None, None });
+        return true;
+    }
+
+    // Macro interface. See HISTORY_LINEAR_POP. Undo: step onto the record being undone.
+    bool PopOp()
+    {
+        assert(m_IsUndoing && "HISTORY_LINEAR_POP belongs into Undo functions!");
+        if (!m_IsUndoing)
+            return false;
+
+        const size_t entry = Step(false);
+        m_Frames.push_back({ entry, Exit(entry), LastChild(entry) });
+        return true;
+    }
+
+    // Macro interface. Leave the innermost record, closing it with an exit marker in Do.
+    void Close()
+    {
+        const size_t entry = m_Frames.back().entry;
+        m_Frames.pop_back();
+
+        if (IsUndoingOrRedoing())
+            return;
+
+        const size_t length = m_Log.GetUsed() - entry;
+        m_Log.SetLink(entry, length);
+        m_Log.Append(0, length);
+
+        if (m_Frames.empty())
+        {
+            m_Roots.Push(m_Log.GetUsed() - m_PresentOffset, m_RecordCount - m_PresentRecords);
+            ++m_PresentIdx;
+            m_PresentOffset = m_Log.GetUsed();
+            m_PresentRecords = m_RecordCount;
+        }
+    }
+
+    // Memento of the innermost record. Asserts if the record holds a different type.
+    // The reference is only valid until the next push - pushes may move the log.
+    template<typename T>
+    T& Memento()
+    {
+        const size_t entry = m_Frames.back().entry;
+        void* memento = HistoryOps::Get(m_Log.Header(entry).op).mementoPayload(m_Log.Payload(entry), HistoryTypeTag<T>());
+        assert(memento && "Record holds no memento of this type, push it with HISTORY_LINEAR_PUSH_MEMENTO!");
+        return *static_cast<T*>(memento);
+    }
+
+private:
+    static constexpr size_t None = SIZE_MAX;
+
+    // Record whose functions are running.
+    struct Frame
+    {
+        size_t entry;
+        size_t exit;
+
+        // Nested record the next push (Redo) / pop (Undo) steps onto.
+        size_t cursor;
+    };
+
+    // Offset of an enter entry's exit marker.
+    size_t Exit(size_t entry) const { return entry + m_Log.GetLink(entry); }
+
+    size_t FirstChild(size_t entry) const
+    {
+        const size_t next = m_Log.Next(entry);
+        return next == Exit(entry) ? None : next;
+    }
+
+    size_t LastChild(size_t entry) const
+    {
+        const size_t prev = m_Log.Prev(Exit(entry));
+        return prev == entry ? None : prev - m_Log.GetLink(prev);
+    }
+
+    // Take the innermost frame's cursor and move it on to the next / previous sibling.
+    size_t Step(bool forward)
+    {
+        Frame& frame = m_Frames.back();
+        const size_t entry = frame.cursor;
+        assert(entry != None && "More nested records replayed than recorded!");
+
+        // Top-level frames hold a single record.
+        frame.cursor = frame.entry == None ? None : Sibling(entry, forward);
+        return entry;
+    }
+
+    // Undo / Redo one record with the innermost frame's cursor on it.
+    // Compound records get a frame of their own on m_Frames and scan their range from it - backwards to undo,
+    // forwards to redo - instead of recursing, so any nesting depth replays in constant native stack.
+    bool RunEntry(size_t entry, bool undo)
+    {
+        const size_t base = m_Frames.size();
+        bool result = true;
+        while (true)
+        {
+            const HistoryOp& op = HistoryOps::Get(m_Log.Header(entry).op);
+            if (!op.undoPayload)
+            {
+                m_Frames.push_back({ entry, Exit(entry), undo ? LastChild(entry) : FirstChild(entry) });
+            }
+            else
+            {
+                result &= undo ? op.undoPayload(nullptr, m_Log.Payload(entry)) : op.redoPayload(nullptr, m_Log.Payload(entry));
+                if (m_Frames.size() == base)
+                    return result;
+
+                m_Frames.back().cursor = Sibling(entry, !undo);
+            }
+
+            // Next nested record of the innermost unfinished compound record.
+            while (m_Frames.back().cursor == None)
+            {
+                const size_t done = m_Frames.back().entry;
+                m_Frames.pop_back();
+                if (m_Frames.size() == base)
+                    return result;
+
+                m_Frames.back().cursor = Sibling(done, !undo);
+            }
+
+            entry = m_Frames.back().cursor;
+        }
+    }
+
+    // Next / previous sibling of a nested record of the innermost frame, or None.
+    size_t Sibling(size_t entry, bool forward) const
+    {
+        const Frame& frame = m_Frames.back();
+        if (forward)
+        {
+            const size_t next = m_Log.Next(Exit(entry));
+            return next == frame.exit ? None : next;
+        }
+
+        const size_t prev = m_Log.Prev(entry);
+        return prev == frame.entry ? None : prev - m_Log.GetLink(prev);
+    }
+
+    void DropRedos()
+    {
+        if (m_PresentIdx == m_Roots.GetSize())
+            return;
+
+        m_Log.Truncate(m_PresentOffset);
+        m_RecordCount = m_PresentRecords;
+        m_Roots.Truncate(m_PresentIdx);
+    }
+
+    HistoryByteLog m_Log;
+
+    // Enter of the innermost open record first. A top-level Undo / Redo starts with an entry-less frame.
+    std::vector<Frame> m_Frames;
+
+    HistoryByteLogRoots m_Roots;
+    size_t m_PresentIdx = 0;
+    size_t m_RecordCount = 0;
+
+    // Log offset and records behind the done top-level records.
+    size_t m_PresentOffset = 0;
+    size_t m_PresentRecords = 0;
+
+    bool m_IsUndoing = false;
+    bool m_IsRedoing = false;
+
+    inline static thread_local HistoryLinearContext* s_Context = nullptr;
+};
+
+// Closes the record a HISTORY_LINEAR_* macro entered, at the end of the function.
+struct HistoryLinearScope
+{
+    HistoryLinearScope(bool active)
+        : m_Context(active ? HistoryLinearContext::GetContext() : nullptr)
+    {
+    }
+
+    ~HistoryLinearScope()
+    {
+        if (m_Context)
+            m_Context->Close();
+    }
+
+    HistoryLinearScope(const HistoryLinearScope&) = delete;
+    HistoryLinearScope& operator=(const HistoryLinearScope&) = delete;
+
+private:
+    HistoryLinearContext* m_Context;
+};
+
+// HISTORY_PUSH for HistoryLinearContext::GetContext().
+// @param func: MEMBER Function name within which this is called.
+// @param ...: func's parameters to store as copies for later use.
+#define HISTORY_LINEAR_PUSH(func, ...) \
+    assert(HistoryLinearContext::GetContext() && "You have to set linear history context first!"); \
+    static const uint32_t _historyOp = HistoryRegisterLinearOp<void, &std::decay<decltype(*this)>::type::func, &std::decay<decltype(*this)>::type::func##_Undo>(#func, this, &std::decay<decltype(*this)>::type::func); \
+    HistoryLinearScope _use_HISTORY_LINEAR_PUSH_for_DoFunc_or_HISTORY_LINEAR_POP_for_UndoFunc(HistoryLinearContext::GetContext()->PushOp(_historyOp, this, &std::decay<decltype(*this)>::type::func, __VA_ARGS__));
+
+// HISTORY_PUSH_MEMENTO for HistoryLinearContext::GetContext(). Access via HISTORY_LINEAR_MEMENTO(memento).
+#define HISTORY_LINEAR_PUSH_MEMENTO(func, memento, ...) \
+    assert(HistoryLinearContext::GetContext() && "You have to set linear history context first!"); \
+    static const uint32_t _historyOp = HistoryRegisterLinearOp<memento, &std::decay<decltype(*this)>::type::func, &std::decay<decltype(*this)>::type::func##_Undo>(#func, this, &std::decay<decltype(*this)>::type::func); \
+    HistoryLinearScope _use_HISTORY_LINEAR_PUSH_for_DoFunc_or_HISTORY_LINEAR_POP_for_UndoFunc(HistoryLinearContext::GetContext()->PushOp<memento>(_historyOp, this, &std::decay<decltype(*this)>::type::func, __VA_ARGS__));
+
+// HISTORY_PUSH_COMPOUND for HistoryLinearContext::GetContext(). No func_Undo mirror needed.
+#define HISTORY_LINEAR_PUSH_COMPOUND(func, ...) \
+    assert(HistoryLinearContext::GetContext() && "You have to set linear history context first!"); \
+    static const uint32_t _historyOp = HistoryRegisterLinearOp<void, &std::decay<decltype(*this)>::type::func, nullptr>(#func, this, &std::decay<decltype(*this)>::type::func); \
+    HistoryLinearScope _use_HISTORY_LINEAR_PUSH_for_DoFunc_or_HISTORY_LINEAR_POP_for_UndoFunc(HistoryLinearContext::GetContext()->PushOp(_historyOp, this, &std::decay<decltype(*this)>::type::func, __VA_ARGS__));
+
+#define HISTORY_LINEAR_POP() \
+    HistoryLinearScope _use_HISTORY_LINEAR_PUSH_for_DoFunc_or_HISTORY_LINEAR_POP_for_UndoFunc(HistoryLinearContext::GetContext()->PopOp());
+
+// Memento of the record being done / undone / redone. Valid until the next push.
+#define HISTORY_LINEAR_MEMENTO(memento) \
+    (_use_HISTORY_LINEAR_PUSH_for_DoFunc_or_HISTORY_LINEAR_POP_for_UndoFunc, HistoryLinearContext::GetContext()->Memento<memento>())
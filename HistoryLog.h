@@ -0,0 +1,506 @@
+#pragma once
+#include "History.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// HistoryOps functions of operation type Op in a HistoryLogContext<Target>.
+template<typename Target, typename Op>
+struct HistoryLogOp
+{
+    static bool Redo(void* target, void* payload) { return static_cast<Op*>(payload)->Redo(*static_cast<Target*>(target)); }
+    static bool Undo(void* target, void* payload) { return static_cast<Op*>(payload)->Undo(*static_cast<Target*>(target)); }
+    static void Destroy(void* payload) { static_cast<Op*>(payload)->~Op(); }
+
+    static void Relocate(void* to, void* from)
+    {
+        new (to) Op(std::move(*static_cast<Op*>(from)));
+        Destroy(from);
+    }
+
+    // Registered on first push of the type.
+    static uint32_t Id()
+    {
+        static const uint32_t s_Op = HistoryOps::Register(Describe());
+        return s_Op;
+    }
+
+private:
+    static HistoryOp Describe()
+    {
+        HistoryOp op;
+        op.redoPayload = &Redo;
+        op.undoPayload = &Undo;
+        if constexpr (!std::is_trivially_copyable_v<Op>)
+        {
+            op.destroyPayload = &Destroy;
+            op.relocatePayload = &Relocate;
+        }
+
+        return op;
+    }
+};
+
+// Contiguous, append-only buffer of variable-length entries: a 16-byte header, then the payload.
+// Entries link to their predecessor, so the log can be walked both ways. Growing it moves the payloads.
+// Headers hold no absolute offsets, only 32-bit distances counted in Alignment units: entries of up to 64 GB,
+// logs of any size. Links too long for that spill into a side table.
+// Payloads are registered in HistoryOps: trivially copyable ones are memcpy'd and never destroyed,
+// others are moved / destroyed through their HistoryOp.
+struct HistoryByteLog
+{
+    static constexpr size_t Alignment = HistoryPool::Granularity;
+
+    // Op of entries without a live payload: markers, or records whose payload isn't constructed yet.
+    static constexpr uint32_t NoOp = UINT32_MAX;
+
+    struct Entry
+    {
+        // HistoryOps index of the payload, NoOp if none.
+        uint32_t op;
+
+        // Alignment units of this entry, header and padding included.
+        uint32_t size;
+
+        // Alignment units of the previous entry, 0 for the first one.
+        uint32_t prevSize;
+
+        // Free for the engine, a distance to a related entry, e.g. the size of a nested range. See GetLink().
+        uint32_t link;
+    };
+
+    // Entry::link of links kept in the side table.
+    static constexpr uint32_t LongLink = UINT32_MAX;
+
+    static_assert(sizeof(Entry) % Alignment == 0, "Payloads must stay aligned");
+
+    // @param capacity: Initial size in bytes. It doubles whenever full.
+    explicit HistoryByteLog(size_t capacity)
+    {
+        Reserve(capacity);
+    }
+
+    ~HistoryByteLog()
+    {
+        Truncate(0);
+        ::operator delete(m_Log, std::align_val_t(Alignment));
+    }
+
+    HistoryByteLog(const HistoryByteLog&) = delete;
+    HistoryByteLog& operator=(const HistoryByteLog&) = delete;
+
+    // Put an entry without a payload at the end. @returns its offset
+    // @param link: Distance in bytes, see SetLink()
+    size_t Append(size_t payloadSize, size_t link = 0)
+    {
+        const size_t units = (sizeof(Entry) + payloadSize + Alignment - 1) / Alignment;
+        assert(units < UINT32_MAX && "Payload is too large for the log!");
+        Reserve(m_Used + units * Alignment);
+
+        const size_t offset = m_Used;
+        Header(offset) = Entry{ NoOp, uint32_t(units), offset ? Header(m_Last).size : 0, 0 };
+        SetLink(offset, link);
+
+        m_Last = offset;
+        m_Used += units * Alignment;
+        return offset;
+    }
+
+    // Distance in bytes from an entry to a related one, a multiple of Alignment.
+    void SetLink(size_t offset, size_t bytes)
+    {
+        const size_t units = bytes / Alignment;
+        if (units < LongLink)
+        {
+            Header(offset).link = uint32_t(units);
+            return;
+        }
+
+        Header(offset).link = LongLink;
+        m_LongLinks[offset] = bytes;
+    }
+
+    size_t GetLink(size_t offset) const
+    {
+        const uint32_t link = Header(offset).link;
+        return link != LongLink ? size_t(link) * Alignment : m_LongLinks.at(offset);
+    }
+
+    // Construct the payload of an entry appended with room for a T.
+    // @param op: Registered operation that knows how to move / destroy a T
+    template<typename T, typename... Params>
+    T& Emplace(size_t offset, uint32_t op, Params&&... params)
+    {
+        static_assert(alignof(T) <= Alignment, "Payload is over-aligned for the log!");
+
+        auto* payload = new (Payload(offset)) T(std::forward<Params>(params)...);
+        Header(offset).op = op;
+        if constexpr (!std::is_trivially_copyable_v<T>)
+            ++m_NonTrivialCount;
+
+        return *payload;
+    }
+
+    // Cut the log at offset, an entry's start, destroying the payloads behind.
+    void Truncate(size_t offset)
+    {
+        if (offset >= m_Used)
+            return;
+
+        const size_t last = offset ? Prev(offset) : 0;
+
+        if (m_NonTrivialCount)
+        {
+            for (size_t it = offset; it < m_Used; it = Next(it))
+            {
+                const Entry& entry = Header(it);
+                if (entry.op == NoOp)
+                    continue;
+
+                if (auto destroy = HistoryOps::Get(entry.op).destroyPayload)
+                {
+                    destroy(Payload(it));
+                    --m_NonTrivialCount;
+                }
+            }
+        }
+
+        if (!m_LongLinks.empty())
+        {
+            for (auto it = m_LongLinks.begin(); it != m_LongLinks.end();)
+                it = it->first >= offset ? m_LongLinks.erase(it) : std::next(it);
+        }
+
+        m_Used = offset;
+        m_Last = last;
+    }
+
+    Entry& Header(size_t offset) const { return *reinterpret_cast<Entry*>(m_Log + offset); }
+    void* Payload(size_t offset) const { return m_Log + offset + sizeof(Entry); }
+
+    size_t Next(size_t offset) const { return offset + size_t(Header(offset).size) * Alignment; }
+    size_t Prev(size_t offset) const { return offset - size_t(Header(offset).prevSize) * Alignment; }
+
+    // Offset of the newest entry.
+    size_t GetLast() const { return m_Last; }
+
+    // Bytes used / allocated.
+    size_t GetUsed() const { return m_Used; }
+    size_t GetCapacity() const { return m_Capacity; }
+
+private:
+    void Reserve(size_t size)
+    {
+        if (size <= m_Capacity)
+            return;
+
+        const size_t capacity = std::max(size, m_Capacity * 2);
+        auto* log = static_cast<std::byte*>(::operator new(capacity, std::align_val_t(Alignment)));
+
+        if (m_Log)
+        {
+            std::memcpy(log, m_Log, m_Used);
+
+            // Raw bytes are fine for everything but non-trivial payloads, move those properly.
+            if (m_NonTrivialCount)
+            {
+                for (size_t offset = 0; offset < m_Used; offset = Next(offset))
+                {
+                    const Entry& entry = Header(offset);
+                    if (entry.op == NoOp)
+                        continue;
+
+                    if (auto relocate = HistoryOps::Get(entry.op).relocatePayload)
+                        relocate(log + offset + sizeof(Entry), Payload(offset));
+                }
+            }
+
+            ::operator delete(m_Log, std::align_val_t(Alignment));
+        }
+
+        m_Log = log;
+        m_Capacity = capacity;
+    }
+
+    std::byte* m_Log = nullptr;
+    size_t m_Capacity = 0;
+    size_t m_Used = 0;
+    size_t m_Last = 0;
+
+    // Live payloads needing destruction / relocation. While 0, truncation and growth never walk the log.
+    size_t m_NonTrivialCount = 0;
+
+    // Entry offset -> link of links beyond 32 bits.
+    std::unordered_map<size_t, size_t> m_LongLinks;
+};
+
+// Top-level records of a HistoryByteLog engine. They lie back to back in the log, so each one is stored
+// as its size and record count only, 32 bits each: 8 bytes per record, no absolute offsets.
+// The engine keeps the offset of the present record as a cursor and steps it by these sizes.
+// Records too large for 32 bits spill into a side table.
+struct HistoryByteLogRoots
+{
+    void Push(size_t bytes, size_t records)
+    {
+        const size_t units = bytes / HistoryByteLog::Alignment;
+        if (units < Spilled && records < Spilled)
+        {
+            m_Roots.push_back({ uint32_t(units), uint32_t(records) });
+            return;
+        }
+
+        m_Large[m_Roots.size()] = { bytes, records };
+        m_Roots.push_back({ Spilled, Spilled });
+    }
+
+    // Bytes of the root's entries, nested ones included.
+    size_t GetBytes(size_t root) const
+    {
+        const Root& item = m_Roots[root];
+        return item.units != Spilled ? size_t(item.units) * HistoryByteLog::Alignment : m_Large.at(root).first;
+    }
+
+    // Records of the root, nested ones included.
+    size_t GetRecords(size_t root) const
+    {
+        const Root& item = m_Roots[root];
+        return item.records != Spilled ? size_t(item.records) : m_Large.at(root).second;
+    }
+
+    // Drop the roots from count on.
+    void Truncate(size_t count)
+    {
+        m_Roots.resize(count);
+        for (auto it = m_Large.begin(); it != m_Large.end();)
+            it = it->first >= count ? m_Large.erase(it) : std::next(it);
+    }
+
+    void Clear()
+    {
+        m_Roots.clear();
+        m_Large.clear();
+    }
+
+    size_t GetSize() const { return m_Roots.size(); }
+
+    // Bytes allocated.
+    size_t GetCapacity() const { return m_Roots.capacity() * sizeof(Root); }
+
+private:
+    static constexpr uint32_t Spilled = UINT32_MAX;
+
+    struct Root
+    {
+        // HistoryByteLog::Alignment units.
+        uint32_t units;
+        uint32_t records;
+    };
+
+    std::vector<Root> m_Roots;
+
+    // Root index -> bytes, records of roots beyond 32 bits.
+    std::unordered_map<size_t, std::pair<size_t, size_t>> m_Large;
+};
+
+// Undo stack storing records as variable-length entries in one HistoryByteLog.
+// An entry's payload is the operation object itself, parameters and mementos included,
+// its link the size of its nested entries, which follow it.
+// Push is a bump append, dropping Redos a tail reset, Undo / Redo walk the log backwards / forwards.
+//
+// Operations follow the HistoryVariantContext protocol, but may be of any type:
+//   template<typename Context> bool Do(Target& target, Context& context)
+//   bool Undo(Target& target)
+//   bool Redo(Target& target)
+// Growing the log moves the stored operations, so Undo / Redo may not keep pointers into them.
+template<typename Target>
+struct HistoryLogContext
+{
+    // @param capacity: Initial size of the log in bytes. It doubles whenever full.
+    explicit HistoryLogContext(Target& target, size_t capacity = 64 * 1024)
+        : m_Target(target)
+        , m_Log(capacity)
+    {
+    }
+
+    // Run op.Do() and append op to the log. Pushes from within Do() become its nested entries.
+    // Top-level pushes drop everything that could be redone.
+    // @returns Do()'s result, false during Undo() / Redo()
+    template<typename Op>
+    bool Push(Op op)
+    {
+        assert(!m_Replaying && "Undo / Redo of an operation may not push!");
+        if (m_Replaying)
+            return false;
+
+        const bool topLevel = m_OpenDepth == 0;
+        if (topLevel)
+            DropRedos();
+
+        // Reserve the entry, nested entries land behind it. The payload is constructed once Do() succeeded.
+        const size_t recordsBefore = m_RecordCount;
+        const size_t offset = m_Log.Append(sizeof(Op));
+        ++m_RecordCount;
+
+        ++m_OpenDepth;
+        const bool result = op.Do(m_Target, *this);
+        --m_OpenDepth;
+
+        const size_t nestedFirst = m_Log.Next(offset);
+        if (!result)
+        {
+            if (m_Log.GetUsed() > nestedFirst)
+            {
+                m_Replaying = true;
+                UndoRange(nestedFirst, m_Log.GetUsed());
+                m_Replaying = false;
+            }
+
+            m_Log.Truncate(offset);
+            m_RecordCount = recordsBefore;
+            return false;
+        }
+
+        m_Log.Emplace<Op>(offset, HistoryLogOp<Target, Op>::Id(), std::move(op));
+        m_Log.SetLink(offset, m_Log.GetUsed() - nestedFirst);
+
+        if (topLevel)
+        {
+            m_Roots.Push(m_Log.GetUsed() - offset, m_RecordCount - recordsBefore);
+            ++m_PresentIdx;
+            m_PresentOffset = m_Log.GetUsed();
+            m_PresentRecords = m_RecordCount;
+        }
+
+        return true;
+    }
+
+    bool Undo()
+    {
+        if (!CanUndo())
+            return false;
+
+        const size_t root = m_PresentIdx - 1;
+        const size_t offset = m_PresentOffset - m_Roots.GetBytes(root);
+
+        m_Replaying = true;
+        const bool result = UndoRange(offset, m_PresentOffset);
+        m_Replaying = false;
+
+        --m_PresentIdx;
+        m_PresentOffset = offset;
+        m_PresentRecords -= m_Roots.GetRecords(root);
+        return result;
+    }
+
+    bool Redo()
+    {
+        if (!CanRedo())
+            return false;
+
+        const size_t root = m_PresentIdx;
+        const size_t end = m_PresentOffset + m_Roots.GetBytes(root);
+
+        m_Replaying = true;
+        const bool result = RedoRange(m_PresentOffset, end);
+        m_Replaying = false;
+
+        ++m_PresentIdx;
+        m_PresentOffset = end;
+        m_PresentRecords += m_Roots.GetRecords(root);
+        return result;
+    }
+
+    bool CanUndo() const { return !m_OpenDepth && !m_Replaying && m_PresentIdx > 0; }
+    bool CanRedo() const { return !m_OpenDepth && !m_Replaying && m_PresentIdx < m_Roots.GetSize(); }
+
+    bool IsUndoingOrRedoing() const { return m_Replaying; }
+
+    // Wipe the stack. Keeps the log's memory.
+    void Clear()
+    {
+        m_Log.Truncate(0);
+        m_Roots.Clear();
+        m_PresentIdx = 0;
+        m_PresentOffset = 0;
+        m_PresentRecords = 0;
+        m_RecordCount = 0;
+    }
+
+    // Top-level records, done ones first.
+    size_t GetSize() const { return m_Roots.GetSize(); }
+
+    // Number of done top-level records.
+    size_t GetPresentIdx() const { return m_PresentIdx; }
+
+    // All records including nested ones.
+    size_t GetRecordCount() const { return m_RecordCount; }
+
+    // Bytes used / allocated by the log.
+    size_t GetByteSize() const { return m_Log.GetUsed(); }
+    size_t GetCapacity() const { return m_Log.GetCapacity(); }
+
+    // Bytes allocated for the top-level record list.
+    size_t GetRootCapacity() const { return m_Roots.GetCapacity(); }
+
+private:
+    void DropRedos()
+    {
+        if (m_PresentIdx == m_Roots.GetSize())
+            return;
+
+        m_Log.Truncate(m_PresentOffset);
+        m_RecordCount = m_PresentRecords;
+        m_Roots.Truncate(m_PresentIdx);
+    }
+
+    // Undo entries [first, end) newest first. Both must be entry offsets.
+    bool UndoRange(size_t first, size_t end)
+    {
+        bool result = true;
+        size_t offset = end == m_Log.GetUsed() ? m_Log.GetLast() : m_Log.Prev(end);
+        while (true)
+        {
+            result &= HistoryOps::Get(m_Log.Header(offset).op).undoPayload(&m_Target, m_Log.Payload(offset));
+
+            if (offset == first)
+                break;
+
+            offset = m_Log.Prev(offset);
+        }
+
+        return result;
+    }
+
+    // Redo entries [first, end) oldest first.
+    bool RedoRange(size_t first, size_t end)
+    {
+        bool result = true;
+        for (size_t offset = first; offset < end; offset = m_Log.Next(offset))
+            result &= HistoryOps::Get(m_Log.Header(offset).op).redoPayload(&m_Target, m_Log.Payload(offset));
+
+        return result;
+    }
+
+    Target& m_Target;
+    HistoryByteLog m_Log;
+
+    size_t m_RecordCount = 0;
+
+    HistoryByteLogRoots m_Roots;
+    size_t m_PresentIdx = 0;
+
+    // Log offset and records behind the done top-level records.
+    size_t m_PresentOffset = 0;
+    size_t m_PresentRecords = 0;
+
+    // Do() calls in progress.
+    int m_OpenDepth = 0;
+
+    bool m_Replaying = false;
+};
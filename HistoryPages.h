@@ -0,0 +1,264 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+// 1 = HistoryPageTracker is available: Linux only, it write-protects memory with mprotect and catches writes via SIGSEGV.
+#ifndef HISTORY_PAGE_TRACKING
+#if defined(__linux__)
+#define HISTORY_PAGE_TRACKING 1
+#else
+#define HISTORY_PAGE_TRACKING 0
+#endif
+#endif
+
+#if HISTORY_PAGE_TRACKING
+#include <csignal>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Copy-on-write tracking of a buffer at page granularity. Begin() write-protects its pages.
+// The first write to each one faults; the handler copies the page aside and lifts the protection,
+// so later writes run at full speed. Cost is proportional to the pages touched, not to the buffer.
+//
+// Only the tracking thread may write the buffer until Finish(). System calls writing into it fail with EFAULT meanwhile.
+// Pages are whole, so writes to neighbouring data on the first / last page fault too. They are let through
+// but never restored - page-aligned buffers avoid the extra faults.
+// A page is tracked by one tracker at a time: Begin() refuses ranges touching pages tracked already.
+struct HistoryPageTracker
+{
+    // Buffers tracked at the same time, process-wide.
+    static constexpr size_t MaxActive = 64;
+
+    HistoryPageTracker() = default;
+    ~HistoryPageTracker() { Finish([](size_t, const std::byte*, size_t) {}); }
+
+    HistoryPageTracker(const HistoryPageTracker&) = delete;
+    HistoryPageTracker& operator=(const HistoryPageTracker&) = delete;
+
+    // Write-protect the pages of [data, data + size).
+    // @returns false if the pages couldn't be protected, are tracked already or too many buffers are tracked,
+    // nothing is tracked then
+    bool Begin(void* data, size_t size)
+    {
+        if (!size)
+            return false;
+
+        const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+        const auto begin = reinterpret_cast<uintptr_t>(data);
+        m_Data = begin;
+        m_Size = size;
+        m_PageSize = pageSize;
+        m_First = begin / pageSize * pageSize;
+        m_PageCount = (begin + size - m_First + pageSize - 1) / pageSize;
+
+        // Everything the fault handler writes lives in this mapping, never on a protected page:
+        // the page copies, then the touched page count and indices, then a copied flag per page.
+        // Untouched parts are never faulted in.
+        const size_t controlSize = sizeof(size_t) * (m_PageCount + 1) + m_PageCount;
+        m_MappedSize = m_PageCount * pageSize + (controlSize + pageSize - 1) / pageSize * pageSize;
+        void* shadow = mmap(nullptr, m_MappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (shadow == MAP_FAILED)
+            return false;
+
+        m_Shadow = static_cast<std::byte*>(shadow);
+        m_TouchedCount = reinterpret_cast<size_t*>(m_Shadow + m_PageCount * pageSize);
+        m_Touched = m_TouchedCount + 1;
+        m_Copied = reinterpret_cast<uint8_t*>(m_Touched + m_PageCount);
+
+        InstallHandler();
+
+        // Another tracker's pages would be unprotected by its Finish() under this one, and the other way round.
+        if (!Register())
+        {
+            Release();
+            return false;
+        }
+
+        if (mprotect(reinterpret_cast<void*>(m_First), m_PageCount * pageSize, PROT_READ) != 0)
+        {
+            Unregister();
+            Release();
+            return false;
+        }
+
+        return true;
+    }
+
+    // Lift the protection and hand out the old contents of the written pages, clipped to the buffer, in address order.
+    // @param keep: Called as keep(offset into the buffer, old bytes, byte count)
+    template<typename Keep>
+    void Finish(Keep&& keep)
+    {
+        if (!m_Shadow)
+            return;
+
+        mprotect(reinterpret_cast<void*>(m_First), m_PageCount * m_PageSize, PROT_READ | PROT_WRITE);
+        Unregister();
+
+        std::sort(m_Touched, m_Touched + *m_TouchedCount);
+        for (size_t i = 0; i < *m_TouchedCount; ++i)
+        {
+            const size_t page = m_Touched[i];
+            const uintptr_t pageBegin = m_First + page * m_PageSize;
+            const uintptr_t begin = std::max(pageBegin, m_Data);
+            const uintptr_t end = std::min(pageBegin + m_PageSize, m_Data + m_Size);
+            keep(size_t(begin - m_Data), m_Shadow + page * m_PageSize + (begin - pageBegin), size_t(end - begin));
+        }
+
+        Release();
+    }
+
+    bool IsTracking() const { return m_Shadow != nullptr; }
+
+    // Pages copied so far.
+    size_t GetTouchedPages() const { return m_Shadow ? *m_TouchedCount : 0; }
+
+private:
+    // Signal handler side. @returns false if address isn't in this buffer's pages
+    bool OnFault(uintptr_t address)
+    {
+        if (address < m_First || address >= m_First + m_PageCount * m_PageSize)
+            return false;
+
+        const size_t page = (address - m_First) / m_PageSize;
+        const uintptr_t pageBegin = m_First + page * m_PageSize;
+        if (!m_Copied[page])
+        {
+            // Just the buffer's part: the rest of the page is never restored.
+            const uintptr_t begin = std::max(pageBegin, m_Data);
+            const uintptr_t end = std::min(pageBegin + m_PageSize, m_Data + m_Size);
+            std::memcpy(m_Shadow + (begin - m_First), reinterpret_cast<const void*>(begin), end - begin);
+
+            m_Copied[page] = 1;
+            m_Touched[(*m_TouchedCount)++] = page;
+        }
+
+        // Always lift the protection, even for a page copied already: returning with the page still
+        // read-only would re-run the faulting write forever.
+        mprotect(reinterpret_cast<void*>(pageBegin), m_PageSize, PROT_READ | PROT_WRITE);
+        return true;
+    }
+
+    void Release()
+    {
+        munmap(m_Shadow, m_MappedSize);
+        m_Shadow = nullptr;
+    }
+
+    static std::atomic<HistoryPageTracker*>* Active()
+    {
+        static std::atomic<HistoryPageTracker*> s_Active[MaxActive] = {};
+        return s_Active;
+    }
+
+    // Serializes Register() / Unregister(), so overlap checks see every tracker. Never taken by the handler.
+    static std::mutex& RegistryMutex()
+    {
+        static std::mutex s_Mutex;
+        return s_Mutex;
+    }
+
+    bool Overlaps(const HistoryPageTracker& other) const
+    {
+        return m_First < other.m_First + other.m_PageCount * other.m_PageSize && other.m_First < m_First + m_PageCount * m_PageSize;
+    }
+
+    // @returns false if all slots are taken or another tracker has one of the pages
+    bool Register()
+    {
+        std::scoped_lock<std::mutex> lock(RegistryMutex());
+        for (size_t i = 0; i < MaxActive; ++i)
+        {
+            const HistoryPageTracker* other = Active()[i].load();
+            if (other && Overlaps(*other))
+                return false;
+        }
+
+        for (size_t i = 0; i < MaxActive; ++i)
+        {
+            HistoryPageTracker* expected = nullptr;
+            if (Active()[i].compare_exchange_strong(expected, this))
+                return true;
+        }
+
+        return false;
+    }
+
+    void Unregister()
+    {
+        std::scoped_lock<std::mutex> lock(RegistryMutex());
+        for (size_t i = 0; i < MaxActive; ++i)
+        {
+            HistoryPageTracker* expected = this;
+            if (Active()[i].compare_exchange_strong(expected, nullptr))
+                return;
+        }
+    }
+
+    static struct sigaction& Previous()
+    {
+        static struct sigaction s_Previous = {};
+        return s_Previous;
+    }
+
+    static void InstallHandler()
+    {
+        static const bool s_Installed = []
+        {
+            struct sigaction action = {};
+            action.sa_sigaction = &HandleFault;
+            action.sa_flags = SA_SIGINFO | SA_NODEFER;
+            sigemptyset(&action.sa_mask);
+            return sigaction(SIGSEGV, &action, &Previous()) == 0;
+        }();
+
+        (void)s_Installed;
+    }
+
+    static void HandleFault(int signal, siginfo_t* info, void* context)
+    {
+        const auto address = reinterpret_cast<uintptr_t>(info->si_addr);
+        for (size_t i = 0; i < MaxActive; ++i)
+        {
+            HistoryPageTracker* tracker = Active()[i].load(std::memory_order_acquire);
+            if (tracker && tracker->OnFault(address))
+                return;
+        }
+
+        // Not ours: the previous handler decides, or the default action kills as it would have.
+        const struct sigaction& previous = Previous();
+        if (previous.sa_flags & SA_SIGINFO)
+        {
+            previous.sa_sigaction(signal, info, context);
+        }
+        else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+        {
+            previous.sa_handler(signal);
+        }
+        else
+        {
+            // Re-executing the faulting instruction raises it again, now unhandled.
+            std::signal(SIGSEGV, SIG_DFL);
+        }
+    }
+
+    uintptr_t m_Data = 0;
+    size_t m_Size = 0;
+
+    uintptr_t m_First = 0;
+    size_t m_PageCount = 0;
+    size_t m_PageSize = 0;
+
+    // Copies of written pages, at their page's offset, followed by the handler's bookkeeping.
+    std::byte* m_Shadow = nullptr;
+    size_t m_MappedSize = 0;
+
+    size_t* m_TouchedCount = nullptr;
+    size_t* m_Touched = nullptr;
+    uint8_t* m_Copied = nullptr;
+};
+#endif
@@ -0,0 +1,611 @@
+#pragma once
+#include "History.h"
+#include <array>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Persistent containers: nodes are immutable and shared between copies.
+// Copying one is O(1) - a root pointer - and every change copies only the O(log32 n) nodes on its path.
+// HISTORY_SAVE of a whole container thus costs next to nothing, however big it is, and HISTORY_LOAD gets it back as fast.
+// Copies are independent values. Nodes come from HistoryPool.
+
+// Set bits of a 32-bit mask.
+inline uint32_t HistoryPopCount(uint32_t bits)
+{
+    bits = bits - ((bits >> 1) & 0x55555555u);
+    bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+    return (((bits + (bits >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+template<typename T>
+using HistoryPoolVector = std::vector<T, HistoryAllocator<T>>;
+
+// Hash map as a hash array mapped trie: 32-way nodes indexed by 5 bits of the hash at a time,
+// entries stored in the node where their slot is free, keys with the same full hash in a collision node at the bottom.
+template<typename Key, typename T, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+struct HistoryPersistentMap
+{
+    using Entry = std::pair<Key, T>;
+
+private:
+    static constexpr size_t Bits = 5;
+    static constexpr size_t HashBits = sizeof(size_t) * 8;
+
+    // Levels down to the collision nodes.
+    static constexpr size_t MaxDepth = HashBits / Bits + 2;
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node
+    {
+        // Slots holding an entry / a child. Both 0 in collision nodes.
+        uint32_t entryMap = 0;
+        uint32_t childMap = 0;
+
+        // Ordered by slot.
+        HistoryPoolVector<Entry> entries;
+        HistoryPoolVector<NodePtr> children;
+    };
+
+public:
+    struct const_iterator
+    {
+        const Entry& operator*() const { return Top().node->entries[Top().entry]; }
+        const Entry* operator->() const { return &**this; }
+
+        const_iterator& operator++()
+        {
+            ++m_Stack[m_Depth - 1].entry;
+            Settle();
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return m_Depth == other.m_Depth && (!m_Depth || (Top().node == other.Top().node && Top().entry == other.Top().entry));
+        }
+
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        struct Frame
+        {
+            const Node* node;
+            uint32_t entry;
+            uint32_t child;
+        };
+
+        const_iterator() = default;
+
+        explicit const_iterator(const Node* root)
+        {
+            if (!root)
+                return;
+
+            m_Stack[m_Depth++] = { root, 0, 0 };
+            Settle();
+        }
+
+        const Frame& Top() const { return m_Stack[m_Depth - 1]; }
+
+        // Move down to the next entry, a node's own entries before its children's. Depth 0 = end.
+        void Settle()
+        {
+            while (m_Depth)
+            {
+                Frame& frame = m_Stack[m_Depth - 1];
+                if (frame.entry < frame.node->entries.size())
+                    return;
+
+                if (frame.child < frame.node->children.size())
+                    m_Stack[m_Depth++] = { frame.node->children[frame.child++].get(), 0, 0 };
+                else
+                    --m_Depth;
+            }
+        }
+
+        std::array<Frame, MaxDepth> m_Stack;
+        size_t m_Depth = 0;
+
+        friend struct HistoryPersistentMap;
+    };
+
+    size_t GetSize() const { return m_Size; }
+    bool IsEmpty() const { return !m_Size; }
+
+    const_iterator begin() const { return const_iterator(m_Root.get()); }
+    const_iterator end() const { return const_iterator(); }
+
+    // @returns nullptr if there is no such key
+    const T* Find(const Key& key) const
+    {
+        const size_t hash = Hash()(key);
+        const Node* node = m_Root.get();
+        for (size_t shift = 0; node; shift += Bits)
+        {
+            if (shift >= HashBits)
+            {
+                for (auto&& entry : node->entries)
+                {
+                    if (KeyEqual()(entry.first, key))
+                        return &entry.second;
+                }
+
+                return nullptr;
+            }
+
+            const uint32_t bit = Bit(hash, shift);
+            if (node->entryMap & bit)
+            {
+                const Entry& entry = node->entries[Slot(node->entryMap, bit)];
+                return KeyEqual()(entry.first, key) ? &entry.second : nullptr;
+            }
+
+            if (!(node->childMap & bit))
+                return nullptr;
+
+            node = node->children[Slot(node->childMap, bit)].get();
+        }
+
+        return nullptr;
+    }
+
+    bool Contains(const Key& key) const { return Find(key) != nullptr; }
+
+    const T& At(const Key& key) const
+    {
+        const T* value = Find(key);
+        assert(value && "No such key!");
+        return *value;
+    }
+
+    // Add or overwrite a key. Copies the nodes on its path, copies made before keep the old value.
+    // @returns true if the key is new
+    bool Set(const Key& key, const T& value)
+    {
+        bool added = false;
+        m_Root = Set(m_Root.get(), Hash()(key), 0, key, value, added);
+        m_Size += added;
+        return added;
+    }
+
+    // @returns false if there is no such key
+    bool Erase(const Key& key)
+    {
+        if (!m_Root)
+            return false;
+
+        bool removed = false;
+        NodePtr root = Erase(m_Root, Hash()(key), 0, key, removed);
+        if (!removed)
+            return false;
+
+        m_Root = std::move(root);
+        --m_Size;
+        return true;
+    }
+
+    void Clear()
+    {
+        m_Root.reset();
+        m_Size = 0;
+    }
+
+private:
+    static uint32_t Bit(size_t hash, size_t shift) { return 1u << ((hash >> shift) & 31); }
+    static size_t Slot(uint32_t map, uint32_t bit) { return HistoryPopCount(map & (bit - 1)); }
+
+    template<typename... Args>
+    static std::shared_ptr<Node> NewNode(Args&&... args)
+    {
+        return std::allocate_shared<Node>(HistoryAllocator<Node>(), std::forward<Args>(args)...);
+    }
+
+    static NodePtr Set(const Node* node, size_t hash, size_t shift, const Key& key, const T& value, bool& added)
+    {
+        auto copy = node ? NewNode(*node) : NewNode();
+        if (shift >= HashBits)
+        {
+            for (auto&& entry : copy->entries)
+            {
+                if (KeyEqual()(entry.first, key))
+                {
+                    entry.second = value;
+                    return copy;
+                }
+            }
+
+            copy->entries.emplace_back(key, value);
+            added = true;
+            return copy;
+        }
+
+        const uint32_t bit = Bit(hash, shift);
+        if (copy->entryMap & bit)
+        {
+            const size_t slot = Slot(copy->entryMap, bit);
+            Entry& entry = copy->entries[slot];
+            if (KeyEqual()(entry.first, key))
+            {
+                entry.second = value;
+                return copy;
+            }
+
+            // Two keys in one slot: both move a level down.
+            auto child = Pair(std::move(entry), Hash()(entry.first), Entry(key, value), hash, shift + Bits);
+            copy->entries.erase(copy->entries.begin() + slot);
+            copy->entryMap &= ~bit;
+            copy->childMap |= bit;
+            copy->children.insert(copy->children.begin() + Slot(copy->childMap, bit), std::move(child));
+            added = true;
+            return copy;
+        }
+
+        if (copy->childMap & bit)
+        {
+            NodePtr& child = copy->children[Slot(copy->childMap, bit)];
+            child = Set(child.get(), hash, shift + Bits, key, value, added);
+            return copy;
+        }
+
+        copy->entryMap |= bit;
+        copy->entries.insert(copy->entries.begin() + Slot(copy->entryMap, bit), Entry(key, value));
+        added = true;
+        return copy;
+    }
+
+    // Node holding two entries whose hashes agree below shift.
+    static NodePtr Pair(Entry&& first, size_t firstHash, Entry&& second, size_t secondHash, size_t shift)
+    {
+        auto node = NewNode();
+        if (shift >= HashBits)
+        {
+            node->entries.push_back(std::move(first));
+            node->entries.push_back(std::move(second));
+            return node;
+        }
+
+        const uint32_t firstBit = Bit(firstHash, shift);
+        const uint32_t secondBit = Bit(secondHash, shift);
+        if (firstBit == secondBit)
+        {
+            node->childMap = firstBit;
+            node->children.push_back(Pair(std::move(first), firstHash, std::move(second), secondHash, shift + Bits));
+            return node;
+        }
+
+        node->entryMap = firstBit | secondBit;
+        if (firstBit > secondBit)
+            std::swap(first, second);
+
+        node->entries.push_back(std::move(first));
+        node->entries.push_back(std::move(second));
+        return node;
+    }
+
+    // @returns the changed node, nullptr once empty. Untouched if !removed.
+    static NodePtr Erase(const NodePtr& node, size_t hash, size_t shift, const Key& key, bool& removed)
+    {
+        if (shift >= HashBits)
+        {
+            for (size_t i = 0; i < node->entries.size(); ++i)
+            {
+                if (!KeyEqual()(node->entries[i].first, key))
+                    continue;
+
+                removed = true;
+                if (node->entries.size() == 1)
+                    return nullptr;
+
+                auto copy = NewNode(*node);
+                copy->entries.erase(copy->entries.begin() + i);
+                return copy;
+            }
+
+            return node;
+        }
+
+        const uint32_t bit = Bit(hash, shift);
+        if (node->entryMap & bit)
+        {
+            const size_t slot = Slot(node->entryMap, bit);
+            if (!KeyEqual()(node->entries[slot].first, key))
+                return node;
+
+            removed = true;
+            if (node->entries.size() == 1 && node->children.empty())
+                return nullptr;
+
+            auto copy = NewNode(*node);
+            copy->entries.erase(copy->entries.begin() + slot);
+            copy->entryMap &= ~bit;
+            return copy;
+        }
+
+        if (!(node->childMap & bit))
+            return node;
+
+        const size_t slot = Slot(node->childMap, bit);
+        NodePtr child = Erase(node->children[slot], hash, shift + Bits, key, removed);
+        if (!removed)
+            return node;
+
+        if (!child && node->children.size() == 1 && node->entries.empty())
+            return nullptr;
+
+        auto copy = NewNode(*node);
+        if (child && !(child->children.empty() && child->entries.size() == 1))
+        {
+            copy->children[slot] = std::move(child);
+            return copy;
+        }
+
+        // Drop the emptied child, or pull its last entry up here: lookups stop at the first entry in their slot.
+        copy->children.erase(copy->children.begin() + slot);
+        copy->childMap &= ~bit;
+        if (child)
+        {
+            copy->entryMap |= bit;
+            copy->entries.insert(copy->entries.begin() + Slot(copy->entryMap, bit), child->entries.front());
+        }
+
+        return copy;
+    }
+
+    NodePtr m_Root;
+    size_t m_Size = 0;
+};
+
+// Hash set on HistoryPersistentMap.
+template<typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+struct HistoryPersistentSet
+{
+private:
+    struct Empty {};
+    using Map = HistoryPersistentMap<Key, Empty, Hash, KeyEqual>;
+
+public:
+    struct const_iterator
+    {
+        const Key& operator*() const { return m_It->first; }
+        const Key* operator->() const { return &m_It->first; }
+
+        const_iterator& operator++()
+        {
+            ++m_It;
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const { return m_It == other.m_It; }
+        bool operator!=(const const_iterator& other) const { return m_It != other.m_It; }
+
+    private:
+        explicit const_iterator(typename Map::const_iterator it) : m_It(it) {}
+
+        typename Map::const_iterator m_It;
+
+        friend struct HistoryPersistentSet;
+    };
+
+    size_t GetSize() const { return m_Items.GetSize(); }
+    bool IsEmpty() const { return m_Items.IsEmpty(); }
+
+    const_iterator begin() const { return const_iterator(m_Items.begin()); }
+    const_iterator end() const { return const_iterator(m_Items.end()); }
+
+    bool Contains(const Key& key) const { return m_Items.Contains(key); }
+
+    // @returns false if the key exists already
+    bool Insert(const Key& key) { return m_Items.Set(key, {}); }
+
+    // @returns false if there is no such key
+    bool Erase(const Key& key) { return m_Items.Erase(key); }
+
+    void Clear() { m_Items.Clear(); }
+
+private:
+    Map m_Items;
+};
+
+// Vector as a 32-way trie over the indices: leaves hold 32 items, inner nodes 32 children.
+// Index, Set, PushBack and PopBack copy one node per level - O(log32 n).
+template<typename T>
+struct HistoryPersistentVector
+{
+private:
+    static constexpr size_t Bits = 5;
+    static constexpr size_t Width = size_t(1) << Bits;
+    static constexpr size_t Mask = Width - 1;
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node
+    {
+        // Inner nodes only.
+        HistoryPoolVector<NodePtr> children;
+
+        // Leaves only.
+        HistoryPoolVector<T> items;
+    };
+
+public:
+    struct const_iterator
+    {
+        const T& operator*() const { return m_Leaf->items[m_Index & Mask]; }
+        const T* operator->() const { return &**this; }
+
+        const_iterator& operator++()
+        {
+            ++m_Index;
+            if (!(m_Index & Mask) && m_Index < m_Vector->m_Size)
+                m_Leaf = m_Vector->Leaf(m_Index);
+
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const { return m_Index == other.m_Index; }
+        bool operator!=(const const_iterator& other) const { return m_Index != other.m_Index; }
+
+    private:
+        const_iterator(const HistoryPersistentVector* vector, size_t index)
+            : m_Vector(vector)
+            , m_Index(index)
+            , m_Leaf(index < vector->m_Size ? vector->Leaf(index) : nullptr)
+        {
+        }
+
+        const HistoryPersistentVector* m_Vector;
+        size_t m_Index;
+
+        // Leaf holding m_Index, looked up once per 32 items.
+        const Node* m_Leaf;
+
+        friend struct HistoryPersistentVector;
+    };
+
+    size_t GetSize() const { return m_Size; }
+    bool IsEmpty() const { return !m_Size; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_Size); }
+
+    const T& operator[](size_t index) const
+    {
+        assert(index < m_Size && "Index out of range!");
+        return Leaf(index)->items[index & Mask];
+    }
+
+    const T& Back() const { return (*this)[m_Size - 1]; }
+
+    void Set(size_t index, const T& value)
+    {
+        assert(index < m_Size && "Index out of range!");
+        m_Root = Set(m_Root.get(), m_Shift, index, value);
+    }
+
+    void PushBack(const T& value)
+    {
+        // Full: the old root becomes the first child of a new one.
+        if (m_Root && m_Size == Width << m_Shift)
+        {
+            auto root = NewNode();
+            root->children.push_back(std::move(m_Root));
+            m_Root = std::move(root);
+            m_Shift += Bits;
+        }
+
+        m_Root = PushBack(m_Root.get(), m_Shift, m_Size, value);
+        ++m_Size;
+    }
+
+    void PopBack()
+    {
+        assert(m_Size && "Vector is empty!");
+        --m_Size;
+        m_Root = PopBack(m_Root.get(), m_Shift, m_Size);
+
+        // Collapse roots with a single child.
+        while (m_Root && m_Shift && m_Root->children.size() == 1)
+        {
+            NodePtr child = m_Root->children.front();
+            m_Root = std::move(child);
+            m_Shift -= Bits;
+        }
+
+        if (!m_Size)
+            m_Shift = 0;
+    }
+
+    void Clear()
+    {
+        m_Root.reset();
+        m_Size = 0;
+        m_Shift = 0;
+    }
+
+private:
+    template<typename... Args>
+    static std::shared_ptr<Node> NewNode(Args&&... args)
+    {
+        return std::allocate_shared<Node>(HistoryAllocator<Node>(), std::forward<Args>(args)...);
+    }
+
+    const Node* Leaf(size_t index) const
+    {
+        const Node* node = m_Root.get();
+        for (size_t shift = m_Shift; shift; shift -= Bits)
+            node = node->children[(index >> shift) & Mask].get();
+
+        return node;
+    }
+
+    static NodePtr Set(const Node* node, size_t shift, size_t index, const T& value)
+    {
+        auto copy = NewNode(*node);
+        if (!shift)
+        {
+            copy->items[index & Mask] = value;
+            return copy;
+        }
+
+        NodePtr& child = copy->children[(index >> shift) & Mask];
+        child = Set(child.get(), shift - Bits, index, value);
+        return copy;
+    }
+
+    // node = nullptr grows a new path.
+    static NodePtr PushBack(const Node* node, size_t shift, size_t index, const T& value)
+    {
+        auto copy = node ? NewNode(*node) : NewNode();
+        if (!shift)
+        {
+            copy->items.push_back(value);
+            return copy;
+        }
+
+        const size_t slot = (index >> shift) & Mask;
+        if (slot < copy->children.size())
+            copy->children[slot] = PushBack(copy->children[slot].get(), shift - Bits, index, value);
+        else
+            copy->children.push_back(PushBack(nullptr, shift - Bits, index, value));
+
+        return copy;
+    }
+
+    // @returns nullptr once empty.
+    static NodePtr PopBack(const Node* node, size_t shift, size_t index)
+    {
+        if (!shift)
+        {
+            if (node->items.size() == 1)
+                return nullptr;
+
+            auto copy = NewNode(*node);
+            copy->items.pop_back();
+            return copy;
+        }
+
+        const size_t slot = (index >> shift) & Mask;
+        NodePtr child = PopBack(node->children[slot].get(), shift - Bits, index);
+        if (!child && !slot)
+            return nullptr;
+
+        auto copy = NewNode(*node);
+        if (child)
+            copy->children[slot] = std::move(child);
+        else
+            copy->children.pop_back();
+
+        return copy;
+    }
+
+    NodePtr m_Root;
+    size_t m_Size = 0;
+
+    // Index bits above the leaves, 5 per inner level.
+    size_t m_Shift = 0;
+};
@@ -0,0 +1,227 @@
+#include "HistoryStats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    std::mutex s_LabelsMutex;
+    std::map<std::string, std::unique_ptr<HistoryLabelStats>> s_Labels;
+
+    // Stats of each HistoryOps operation, chunked like HistoryOps itself. Resolved on the operation's
+    // first timed call, after which Begin() needs neither the lock nor the label lookup.
+    std::atomic<std::atomic<HistoryLabelStats*>*> s_OpStats[HistoryOps::MaxChunks] = {};
+
+    // Operation being timed on this thread.
+    struct Frame
+    {
+        std::chrono::steady_clock::time_point start;
+        uint64_t nestedNs;
+
+        // nullptr if the enclosing frame times the same record and operation.
+        HistoryLabelStats* stats;
+        History* record;
+        HistoryOperation operation;
+    };
+
+    thread_local std::vector<Frame> s_Frames;
+}
+
+HistoryLatencyHistogram::HistoryLatencyHistogram()
+{
+    Reset();
+}
+
+void HistoryLatencyHistogram::Record(uint64_t nanoseconds)
+{
+    int bucket = 0;
+    for (uint64_t value = nanoseconds; value > 1 && bucket < BucketCount - 1; value >>= 1)
+        ++bucket;
+
+    m_Buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_Count.fetch_add(1, std::memory_order_relaxed);
+    m_TotalNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t max = m_MaxNs.load(std::memory_order_relaxed);
+    while (nanoseconds > max && !m_MaxNs.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+}
+
+void HistoryLatencyHistogram::Reset()
+{
+    for (auto& bucket : m_Buckets)
+        bucket.store(0, std::memory_order_relaxed);
+
+    m_Count.store(0, std::memory_order_relaxed);
+    m_TotalNs.store(0, std::memory_order_relaxed);
+    m_MaxNs.store(0, std::memory_order_relaxed);
+}
+
+double HistoryLatencyHistogram::GetMeanNs() const
+{
+    const uint64_t count = GetCount();
+    return count ? double(GetTotalNs()) / double(count) : 0.0;
+}
+
+uint64_t HistoryLatencyHistogram::GetQuantileNs(double quantile) const
+{
+    const uint64_t count = GetCount();
+    if (!count)
+        return 0;
+
+    // Rank of the sample at the quantile: the smallest rank covering that fraction of all samples.
+    const uint64_t target = std::clamp<uint64_t>(uint64_t(std::ceil(std::clamp(quantile, 0.0, 1.0) * double(count))), 1, count);
+    uint64_t seen = 0;
+    for (int i = 0; i < BucketCount; ++i)
+    {
+        seen += m_Buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+            return i < BucketCount - 1 ? std::min((uint64_t(2) << i) - 1, GetMaxNs()) : GetMaxNs();
+    }
+
+    return GetMaxNs();
+}
+
+HistoryLabelStats& HistoryStats::ForLabel(const std::string& label)
+{
+    std::scoped_lock<std::mutex> lock(s_LabelsMutex);
+
+    auto& stats = s_Labels[label];
+    if (!stats)
+    {
+        stats = std::make_unique<HistoryLabelStats>();
+        stats->label = label;
+    }
+
+    return *stats;
+}
+
+HistoryLabelStats& HistoryStats::ForOp(uint32_t op)
+{
+    auto& chunk = s_OpStats[op / HistoryOps::ChunkSize];
+    std::atomic<HistoryLabelStats*>* slots = chunk.load(std::memory_order_acquire);
+    if (!slots)
+    {
+        auto* newSlots = new std::atomic<HistoryLabelStats*>[HistoryOps::ChunkSize]();
+        if (chunk.compare_exchange_strong(slots, newSlots, std::memory_order_acq_rel))
+            slots = newSlots;
+        else
+            delete[] newSlots;
+    }
+
+    auto& slot = slots[op % HistoryOps::ChunkSize];
+    HistoryLabelStats* stats = slot.load(std::memory_order_acquire);
+    if (!stats)
+    {
+        // Racing threads resolve the same label to the same stats.
+        stats = &ForLabel(HistoryOps::Get(op).label);
+        slot.store(stats, std::memory_order_release);
+    }
+
+    return *stats;
+}
+
+void HistoryStats::ForEach(const std::function<void(const HistoryLabelStats&)>& func)
+{
+    std::scoped_lock<std::mutex> lock(s_LabelsMutex);
+    for (auto&& [label, stats] : s_Labels)
+        func(*stats);
+}
+
+std::string HistoryStats::Dump()
+{
+    static const char* s_OperationNames[] = { "Do", "Undo", "Redo" };
+
+    std::string result = "label\top\tcount\tmean_ns\tp50_ns\tp99_ns\tmax_ns\texcl_mean_ns\texcl_p99_ns\n";
+    ForEach([&result](const HistoryLabelStats& stats)
+    {
+        for (size_t op = 0; op < size_t(HistoryOperation::Count); ++op)
+        {
+            const auto& inclusive = stats.inclusive[op];
+            const auto& exclusive = stats.exclusive[op];
+            if (!inclusive.GetCount())
+                continue;
+
+            char line[256];
+            std::snprintf(line, sizeof(line), "\t%s\t%llu\t%.0f\t%llu\t%llu\t%llu\t%.0f\t%llu\n",
+                s_OperationNames[op],
+                (unsigned long long)inclusive.GetCount(),
+                inclusive.GetMeanNs(),
+                (unsigned long long)inclusive.GetQuantileNs(0.5),
+                (unsigned long long)inclusive.GetQuantileNs(0.99),
+                (unsigned long long)inclusive.GetMaxNs(),
+                exclusive.GetMeanNs(),
+                (unsigned long long)exclusive.GetQuantileNs(0.99));
+
+            result += stats.label;
+            result += line;
+        }
+    });
+
+    return result;
+}
+
+void HistoryStats::Reset()
+{
+    ForEach([](const HistoryLabelStats& stats)
+    {
+        auto& mutableStats = const_cast<HistoryLabelStats&>(stats);
+        for (size_t op = 0; op < size_t(HistoryOperation::Count); ++op)
+        {
+            mutableStats.inclusive[op].Reset();
+            mutableStats.exclusive[op].Reset();
+        }
+    });
+}
+
+void HistoryStats::Begin(History* record, HistoryOperation operation)
+{
+#if HISTORY_INSTRUMENTATION
+    if (!s_Frames.empty() && s_Frames.back().record == record && s_Frames.back().operation == operation)
+    {
+        s_Frames.push_back({ {}, 0, nullptr, record, operation });
+        return;
+    }
+
+    // Records outside HistoryOps carry their own label - the slow path.
+    HistoryLabelStats* stats = record->GetOp() == HistoryOps::Named ? &ForLabel(record->GetLabel()) : &ForOp(record->GetOp());
+    s_Frames.push_back({ std::chrono::steady_clock::now(), 0, stats, record, operation });
+#else
+    (void)record;
+    (void)operation;
+#endif
+}
+
+void HistoryStats::End()
+{
+    if (s_Frames.empty())
+        return;
+
+    const Frame frame = s_Frames.back();
+    s_Frames.pop_back();
+
+    // Part of the enclosing frame's sample.
+    if (!frame.stats)
+    {
+        if (!s_Frames.empty())
+            s_Frames.back().nestedNs += frame.nestedNs;
+
+        return;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frame.start);
+    const uint64_t inclusive = uint64_t(elapsed.count());
+    const uint64_t exclusive = inclusive > frame.nestedNs ? inclusive - frame.nestedNs : 0;
+
+    frame.stats->inclusive[size_t(frame.operation)].Record(inclusive);
+    frame.stats->exclusive[size_t(frame.operation)].Record(exclusive);
+
+    if (!s_Frames.empty())
+        s_Frames.back().nestedNs += inclusive;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "History.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Which delegate of a History object ran.
+enum class HistoryOperation
+{
+    Do,     // First execution, right after the push
+    Undo,
+    Redo,
+    Count
+};
+
+// Lock-free latency histogram with power-of-two nanosecond buckets.
+struct HistoryLatencyHistogram
+{
+    static constexpr int BucketCount = 64;
+
+    HistoryLatencyHistogram();
+
+    void Record(uint64_t nanoseconds);
+    void Reset();
+
+    uint64_t GetCount() const { return m_Count.load(std::memory_order_relaxed); }
+    uint64_t GetTotalNs() const { return m_TotalNs.load(std::memory_order_relaxed); }
+    uint64_t GetMaxNs() const { return m_MaxNs.load(std::memory_order_relaxed); }
+    double GetMeanNs() const;
+
+    // Upper bound of the bucket holding the given quantile (0..1), capped by the maximum.
+    uint64_t GetQuantileNs(double quantile) const;
+
+private:
+    // Bucket i holds samples in [2^i, 2^(i+1)) ns, bucket 0 also holds 0.
+    std::atomic<uint64_t> m_Buckets[BucketCount];
+    std::atomic<uint64_t> m_Count;
+    std::atomic<uint64_t> m_TotalNs;
+    std::atomic<uint64_t> m_MaxNs;
+};
+
+// Latencies of all History objects sharing a label.
+struct HistoryLabelStats
+{
+    std::string label;
+
+    // Whole delegate call, nested History objects included.
+    HistoryLatencyHistogram inclusive[size_t(HistoryOperation::Count)];
+
+    // Delegate call minus the time spent in nested History objects.
+    HistoryLatencyHistogram exclusive[size_t(HistoryOperation::Count)];
+};
+
+// Per-label latency statistics, gathered when compiled with HISTORY_INSTRUMENTATION=1.
+// Without it, nothing is ever recorded and History costs exactly what it did before.
+struct HistoryStats
+{
+    // Stats of one label. Created on first use, never destroyed.
+    static HistoryLabelStats& ForLabel(const std::string& label);
+
+    // Stats of the label of a HistoryOps operation. Lock-free once the operation has been seen.
+    static HistoryLabelStats& ForOp(uint32_t op);
+
+    // Visit all labels seen so far. Histograms may be read while other threads record.
+    static void ForEach(const std::function<void(const HistoryLabelStats&)>& func);
+
+    // Table of all non-empty histograms, one line per label and operation.
+    static std::string Dump();
+
+    // Zero all histograms.
+    static void Reset();
+
+    // Time an operation of a History object. Calls nest per thread. A call for the record and operation
+    // being timed already, like the delegate of a record HistoryContext::Undo() times, adds no sample of its own.
+    static void Begin(History* record, HistoryOperation operation);
+    static void End();
+};
+
+// Times an operation of a History object for the lifetime of the scope.
+struct HistoryStatsScope
+{
+    HistoryStatsScope(History* record, HistoryOperation operation)
+    {
+        HistoryStats::Begin(record, operation);
+    }
+
+    ~HistoryStatsScope()
+    {
+        HistoryStats::End();
+    }
+
+    HistoryStatsScope(const HistoryStatsScope&) = delete;
+    HistoryStatsScope& operator=(const HistoryStatsScope&) = delete;
+};
@@ -0,0 +1,195 @@
+#include "HistoryTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+namespace
+{
+    // Ring buffer slot. The stamp tells which event it holds: 2 * (n + 1) once the n-th event is written,
+    // odd while a writer is inside, 0 if empty. Writers of events a capacity apart never mix their fields.
+    struct Slot
+    {
+        std::atomic<uint64_t> stamp = 0;
+        HistoryTraceEvent event;
+    };
+
+    std::unique_ptr<Slot[]> s_Slots;
+    size_t s_Capacity = 0;
+    std::atomic<uint64_t> s_Written = 0;
+    std::chrono::steady_clock::time_point s_Start;
+
+    // Append() calls in flight. Start() and Stop() wait for them, so the buffer never changes under a writer.
+    std::atomic<int> s_Writers = 0;
+
+    void WaitForWriters()
+    {
+        while (s_Writers.load())
+            std::this_thread::yield();
+    }
+
+    std::atomic<uint32_t> s_NextThread = 0;
+
+    uint32_t CurrentThread()
+    {
+        thread_local uint32_t s_Thread = s_NextThread.fetch_add(1) + 1;
+        return s_Thread;
+    }
+
+    void AppendEscaped(std::string& out, const char* text)
+    {
+        for (; *text; ++text)
+        {
+            const char c = *text;
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+    }
+}
+
+std::atomic<bool> HistoryTrace::s_Recording = false;
+
+void HistoryTrace::Start(size_t capacity)
+{
+    s_Recording = false;
+    WaitForWriters();
+
+    s_Capacity = capacity ? capacity : 1;
+    s_Slots = std::make_unique<Slot[]>(s_Capacity);
+    s_Written = 0;
+    s_Start = std::chrono::steady_clock::now();
+
+    s_Recording = true;
+}
+
+void HistoryTrace::Stop()
+{
+    s_Recording = false;
+    WaitForWriters();
+}
+
+size_t HistoryTrace::GetEventCount()
+{
+    return size_t(std::min<uint64_t>(s_Written.load(), s_Capacity));
+}
+
+void HistoryTrace::Begin(HistoryTraceCategory category, const char* label)
+{
+    Append(category, label, true);
+}
+
+void HistoryTrace::End(HistoryTraceCategory category, const char* label)
+{
+    Append(category, label, false);
+}
+
+void HistoryTrace::Append(HistoryTraceCategory category, const char* label, bool begin)
+{
+    // Announce the write before checking the flag: Start() / Stop() clear the flag before waiting.
+    s_Writers.fetch_add(1);
+    if (!s_Recording.load())
+    {
+        s_Writers.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    const uint64_t n = s_Written.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = s_Slots[size_t(n % s_Capacity)];
+
+    // Claim the slot. A newer event there wins, an older one still being written is waited for.
+    uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+    while (true)
+    {
+        if (stamp >= 2 * (n + 1))
+        {
+            s_Writers.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+
+        if (stamp & 1)
+        {
+            std::this_thread::yield();
+            stamp = slot.stamp.load(std::memory_order_acquire);
+        }
+        else if (slot.stamp.compare_exchange_weak(stamp, 2 * n + 1, std::memory_order_acquire))
+        {
+            break;
+        }
+    }
+
+    HistoryTraceEvent& event = slot.event;
+    event.timestampNs = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Start).count());
+    event.thread = CurrentThread();
+    event.category = category;
+    event.begin = begin;
+
+    std::strncpy(event.label, label, HistoryTraceEvent::MaxLabel);
+    event.label[HistoryTraceEvent::MaxLabel] = 0;
+
+    slot.stamp.store(2 * (n + 1), std::memory_order_release);
+    s_Writers.fetch_sub(1, std::memory_order_release);
+}
+
+std::string HistoryTrace::ExportChromeJson()
+{
+    static const char* s_CategoryNames[] = { "do", "undo", "redo", "save", "load" };
+
+    const uint64_t written = s_Written.load();
+    const size_t count = GetEventCount();
+    const uint64_t first = written - count;
+
+    std::string result = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    result.reserve(result.size() + count * 96);
+
+    bool empty = true;
+    for (uint64_t i = first; i < written; ++i)
+    {
+        // Skip events lost to a newer one in the same slot.
+        const Slot& slot = s_Slots[size_t(i % s_Capacity)];
+        if (slot.stamp.load(std::memory_order_acquire) != 2 * (i + 1))
+            continue;
+
+        const HistoryTraceEvent& event = slot.event;
+
+        char fields[128];
+        std::snprintf(fields, sizeof(fields), "\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+            s_CategoryNames[size_t(event.category)],
+            event.begin ? 'B' : 'E',
+            double(event.timestampNs) / 1000.0,
+            event.thread);
+
+        result += empty ? "\n{\"name\":\"" : ",\n{\"name\":\"";
+        empty = false;
+        AppendEscaped(result, event.label);
+        result += fields;
+    }
+
+    result += "\n]}\n";
+    return result;
+}
+
+bool HistoryTrace::ExportChromeJson(const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    file << ExportChromeJson();
+    return bool(file);
+}
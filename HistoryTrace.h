@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// What a trace event spans.
+enum class HistoryTraceCategory : uint8_t
+{
+    Do,     // Do delegate right after the push, nested records included
+    Undo,   // Undo delegate / HistoryContext::Undo() call
+    Redo,   // Redo delegate / HistoryContext::Redo() call
+    Save,   // HISTORY_SAVE
+    Load,   // HISTORY_LOAD
+    Count
+};
+
+// One begin or end event. Labels are copied, so records may die before export.
+struct HistoryTraceEvent
+{
+    static constexpr size_t MaxLabel = 47;
+
+    uint64_t timestampNs;
+    uint32_t thread;
+    HistoryTraceCategory category;
+    bool begin;
+    char label[MaxLabel + 1];
+};
+
+// Records begin / end events of History operations into a preallocated ring buffer, when
+// compiled with HISTORY_TRACING=1. Export as Chrome trace JSON, viewable in chrome://tracing or Perfetto.
+// Nesting comes from HistoryPushController / HistoryPopController, so nested records show up as nested slices.
+struct HistoryTrace
+{
+    // Allocate the ring buffer and start recording. Oldest events are overwritten when full.
+    // Waits for events still being appended, the buffer is never reallocated under a writer.
+    static void Start(size_t capacity = 1 << 16);
+
+    // Stop recording and wait for events still being appended. Events stay until the next Start().
+    static void Stop();
+
+    static bool IsRecording() { return s_Recording.load(std::memory_order_relaxed); }
+
+    // Events in the buffer, at most its capacity.
+    static size_t GetEventCount();
+
+    // Chrome trace JSON of the recorded events, oldest first. Call after Stop().
+    static std::string ExportChromeJson();
+
+    // Write ExportChromeJson() into a file.
+    // @returns false if the file couldn't be written
+    static bool ExportChromeJson(const std::string& path);
+
+    static void Begin(HistoryTraceCategory category, const char* label);
+    static void End(HistoryTraceCategory category, const char* label);
+
+private:
+    static void Append(HistoryTraceCategory category, const char* label, bool begin);
+
+    static std::atomic<bool> s_Recording;
+};
+
+// Begin event now, end event at the end of the scope.
+struct HistoryTraceScope
+{
+    // label must outlive the scope, e.g. a string literal.
+    HistoryTraceScope(HistoryTraceCategory category, const char* label)
+        : m_Category(category)
+        , m_Label(label)
+    {
+        if (HistoryTrace::IsRecording())
+            HistoryTrace::Begin(m_Category, m_Label);
+    }
+
+    // Copies label, only while recording.
+    HistoryTraceScope(HistoryTraceCategory category, const std::string& label)
+        : m_Category(category)
+    {
+        if (HistoryTrace::IsRecording())
+        {
+            m_OwnLabel = label;
+            m_Label = m_OwnLabel.c_str();
+            HistoryTrace::Begin(m_Category, m_Label);
+        }
+    }
+
+    ~HistoryTraceScope()
+    {
+        if (m_Label && HistoryTrace::IsRecording())
+            HistoryTrace::End(m_Category, m_Label);
+    }
+
+    HistoryTraceScope(const HistoryTraceScope&) = delete;
+    HistoryTraceScope& operator=(const HistoryTraceScope&) = delete;
+
+private:
+    HistoryTraceCategory m_Category;
+    const char* m_Label = nullptr;
+    std::string m_OwnLabel;
+};
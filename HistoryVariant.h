@@ -0,0 +1,199 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Undo stack for a closed set of operations known at compile time.
+// Records live by value in one contiguous array in push order - every record is followed by its nested ones -
+// and run through std::visit instead of virtual calls and std::function, so the compiler can inline them.
+//
+// An operation is a struct with:
+//   template<typename Context> bool Do(Target& target, Context& context)
+//                                  First execution. May push nested operations through context.
+//                                  Returning false means nothing was applied: nested records it pushed are undone and dropped.
+//   bool Undo(Target& target)      Reverts its own effects - nested records are undone by the context.
+//   bool Redo(Target& target)      Re-applies its own effects - nested records are redone by the context.
+//
+// Each operation must apply its own effects before it pushes nested operations.
+// Undo then walks a record's range backwards, Redo forwards.
+template<typename Target, typename... Ops>
+struct HistoryVariantContext
+{
+    using Record = std::variant<std::monostate, Ops...>;
+
+    explicit HistoryVariantContext(Target& target)
+        : m_Target(target)
+    {
+    }
+
+    // Run op.Do() and record op. Pushes from within Do() become its nested records.
+    // Top-level pushes drop everything that could be redone.
+    // @returns Do()'s result, false during Undo() / Redo()
+    template<typename Op>
+    bool Push(Op op)
+    {
+        static_assert((std::is_same_v<Op, Ops> || ...), "Operation is not part of this context's set!");
+
+        assert(!m_Replaying && "Undo / Redo of an operation may not push!");
+        if (m_Replaying)
+            return false;
+
+        const bool topLevel = m_OpenDepth == 0;
+        if (topLevel)
+            DropRedos();
+
+        // Reserve the slot, nested records land behind it.
+        const size_t idx = m_Records.size();
+        m_Records.emplace_back();
+        if (topLevel)
+            m_Roots.push_back(idx);
+
+        ++m_OpenDepth;
+        const bool result = op.Do(m_Target, *this);
+        --m_OpenDepth;
+
+        if (!result)
+        {
+            m_Replaying = true;
+            UndoRange(idx + 1, m_Records.size());
+            m_Replaying = false;
+
+            m_Records.resize(idx);
+            if (topLevel)
+                m_Roots.pop_back();
+
+            return false;
+        }
+
+        m_Records[idx].op.template emplace<Op>(std::move(op));
+        m_Records[idx].nested = uint32_t(m_Records.size() - idx - 1);
+
+        if (topLevel)
+            ++m_PresentIdx;
+
+        return true;
+    }
+
+    bool Undo()
+    {
+        if (!CanUndo())
+            return false;
+
+        const size_t first = m_Roots[m_PresentIdx - 1];
+
+        m_Replaying = true;
+        const bool result = UndoRange(first, first + m_Records[first].nested + 1);
+        m_Replaying = false;
+
+        --m_PresentIdx;
+        return result;
+    }
+
+    bool Redo()
+    {
+        if (!CanRedo())
+            return false;
+
+        const size_t first = m_Roots[m_PresentIdx];
+
+        m_Replaying = true;
+        const bool result = RedoRange(first, first + m_Records[first].nested + 1);
+        m_Replaying = false;
+
+        ++m_PresentIdx;
+        return result;
+    }
+
+    bool CanUndo() const { return !m_OpenDepth && !m_Replaying && m_PresentIdx > 0; }
+    bool CanRedo() const { return !m_OpenDepth && !m_Replaying && m_PresentIdx < m_Roots.size(); }
+
+    bool IsUndoingOrRedoing() const { return m_Replaying; }
+
+    // Wipe the stack.
+    void Clear()
+    {
+        m_Records.clear();
+        m_Roots.clear();
+        m_PresentIdx = 0;
+    }
+
+    // Top-level records, done ones first.
+    size_t GetSize() const { return m_Roots.size(); }
+
+    // Number of done top-level records.
+    size_t GetPresentIdx() const { return m_PresentIdx; }
+
+    // All records including nested ones.
+    size_t GetRecordCount() const { return m_Records.size(); }
+
+private:
+    struct Entry
+    {
+        Record op;
+
+        // Number of nested records following this one.
+        uint32_t nested = 0;
+    };
+
+    bool UndoRange(size_t first, size_t end)
+    {
+        bool result = true;
+        for (size_t i = end; i-- > first;)
+        {
+            result &= std::visit([this](auto& op)
+            {
+                if constexpr (std::is_same_v<std::decay_t<decltype(op)>, std::monostate>)
+                    return true;
+                else
+                    return op.Undo(m_Target);
+            }, m_Records[i].op);
+        }
+
+        return result;
+    }
+
+    bool RedoRange(size_t first, size_t end)
+    {
+        bool result = true;
+        for (size_t i = first; i < end; ++i)
+        {
+            result &= std::visit([this](auto& op)
+            {
+                if constexpr (std::is_same_v<std::decay_t<decltype(op)>, std::monostate>)
+                    return true;
+                else
+                    return op.Redo(m_Target);
+            }, m_Records[i].op);
+        }
+
+        return result;
+    }
+
+    void DropRedos()
+    {
+        if (m_PresentIdx == m_Roots.size())
+            return;
+
+        m_Records.resize(m_Roots[m_PresentIdx]);
+        m_Roots.resize(m_PresentIdx);
+    }
+
+    Target& m_Target;
+
+    // Every record, parents before their nested ones.
+    std::vector<Entry> m_Records;
+
+    // Index of each top-level record in m_Records.
+    std::vector<size_t> m_Roots;
+
+    size_t m_PresentIdx = 0;
+
+    // Do() calls in progress.
+    int m_OpenDepth = 0;
+
+    bool m_Replaying = false;
+};
@@ -1,5 +1,7 @@
 #include "History.h"
 #include "Showcase.h"
+#include <algorithm>
+#include <thread>
 
 ManagerBase::ManagerBase()
 {
@@ -230,11 +232,669 @@ void HistoryShowcase_Advanced()
     assert((mgr.objects.size() == 1) && (mgr.objects["foobar"] == std::set<int>{7, 8, 11, 23, 49}));
 }
 
+void HistoryShowcase_BackgroundJobs()
+{
+    MapManager mgr;
+
+    // A worker does the work, then queues the record. It must not touch the stack itself.
+    std::thread worker([&mgr]()
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            const std::string key = "job" + std::to_string(i);
+            mgr.objects[key] = i;
+            mgr.context.Enqueue<const std::string&, int>("AddObject", hBind(&mgr, &MapManager::AddObject), hBind(&mgr, &MapManager::AddObject_Undo), key, i);
+        }
+    });
+    worker.join();
+
+    // Nothing lands until the owner drains, then in Enqueue() order.
+    assert(mgr.context.HasPending() && (mgr.context.GetStackData().size() == 1));
+    assert((mgr.context.DrainPending() == 3) && !mgr.context.HasPending());
+    assert((mgr.context.GetStackData().size() == 4) && (mgr.objects.size() == 3));
+
+    // The last queued job is undone first.
+    mgr.context.Undo();
+    assert((mgr.objects.size() == 2) && !mgr.objects.count("job2"));
+    mgr.context.Undo();
+    assert((mgr.objects.size() == 1) && mgr.objects.count("job0"));
+    mgr.context.Redo();
+    mgr.context.Redo();
+    assert((mgr.objects.size() == 3) && (mgr.objects["job2"] == 2));
+}
+
+void HistoryShowcase_ReadSnapshots()
+{
+    MapManager mgr;
+    mgr.context.EnableSnapshots();
+    mgr.AddObject("foo", 1);
+    mgr.AddObject("bar", 2);
+    const auto barId = mgr.context.Present()->GetId();
+    {
+        // Pinned before "bar" is dropped - the old view keeps both the entry and the record behind it.
+        HistoryReadGuard old(mgr.context);
+        mgr.context.Undo();
+        mgr.AddObject("baz", 3);
+
+        assert((old->entries.size() == 2) && (old->presentIdx == 2));
+        const HistorySnapshot::Entry top = *old->entries.begin();
+        assert((top.record->GetId() == barId) && (top.record->GetLabel() == "AddObject") && top.present);
+
+        // A new guard sees the push.
+        HistoryReadGuard latest(mgr.context);
+        assert((latest->entries.size() == 2) && (latest->presentIdx == 2) && (latest->version > old->version));
+        assert((*latest->entries.begin()).record->GetId() != barId);
+    }
+
+    // Readers on other threads see the same snapshots.
+    size_t seen = 0;
+    std::thread reader([&mgr, &seen]()
+    {
+        HistoryReadGuard guard(mgr.context);
+        for (const HistorySnapshot::Entry entry : guard->entries)
+            seen += entry.record->GetLabel() == "AddObject";
+    });
+    reader.join();
+    assert(seen == 2);
+}
+
+void HistoryShowcase_Async()
+{
+    MapManager mgr;
+    mgr.AddObject("foo", 1);
+    mgr.AddObject("bar", 2);
+
+    // Requests run in order on a worker. Once a future is ready, its effects are visible here.
+    std::future<bool> first = mgr.context.UndoAsync();
+    std::future<bool> second = mgr.context.UndoAsync();
+    assert(first.get() && second.get());
+    assert(!mgr.context.IsBusy() && mgr.objects.empty());
+
+    // Nothing left to undo: the request completes with false.
+    assert(!mgr.context.UndoAsync().get());
+
+    assert(mgr.context.RedoAsync().get() && !mgr.context.IsBusy());
+    assert((mgr.objects.size() == 1) && (mgr.objects["foo"] == 1));
+}
+
+/// 
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+bool CompoundManager::MergeAll(const std::set<std::string>& keys, const std::string& newKey)
+{
+    // No MergeAll_Undo: the subrecords are unwound / replayed by History.
+    HISTORY_PUSH_COMPOUND(MergeAll, keys, newKey);
+
+    std::set<int> merged;
+    for (auto&& key : keys)
+        merged.insert(objects[key].begin(), objects[key].end());
+
+    for (auto&& key : keys)
+        RemoveObject(key);
+
+    SetObject(newKey, merged);
+    return true;
+}
+
+void HistoryShowcase_Compound()
+{
+    CompoundManager mgr;
+    for (int i = 0; i < 100; ++i)
+        mgr.SetObject(std::to_string(i), { i });
+
+    std::set<std::string> keys;
+    for (auto&& [key, values] : mgr.objects)
+        keys.insert(key);
+
+    mgr.MergeAll(keys, "all");
+    assert((mgr.objects.size() == 1) && (mgr.objects["all"].size() == 100));
+
+    // Undo one subrecord per frame
+    auto stepper = History::GetContext()->BeginUndo();
+    assert(stepper && stepper->GetTotalSteps() == 101);
+    while (!stepper->Step(std::chrono::microseconds(0)))
+        assert(stepper->GetProgress() < 1.f);
+    assert((mgr.objects.size() == 100) && (mgr.objects["42"] == std::set<int>{42}));
+
+    // Cancel halfway through
+    stepper = History::GetContext()->BeginRedo();
+    for (int i = 0; i < 50; ++i)
+        stepper->Step(std::chrono::microseconds(0));
+    stepper->Cancel();
+    assert(mgr.objects.size() == 100);
+
+    History::GetContext()->Redo();
+    assert((mgr.objects.size() == 1) && (mgr.objects["all"].size() == 100));
+    History::GetContext()->Undo();
+    assert(mgr.objects.size() == 100);
+}
+
+void HistoryShowcase_FindById()
+{
+    MergingManager mgr;
+    mgr.SetObject("foo", { 1 });
+    mgr.SetObject("bar", { 2 });
+    mgr.MergeObjects({ "foo", "bar" }, "baz");
+
+    // IDs stay valid handles: Find() locates top-level and nested records alike.
+    const HistoryId mergeId = mgr.context.Present()->GetId();
+    const HistoryLocation* merge = mgr.context.Find(mergeId);
+    assert(merge && (merge->record == mgr.context.Present()) && (merge->context == &mgr.context) && (merge->index == 3) && (merge->depth == 0));
+
+    const HistoryContext& subcontext = mgr.context.Present()->GetSubcontext();
+    const HistoryId nestedId = subcontext.Present()->GetId();
+    const HistoryLocation* nested = mgr.context.Find(nestedId);
+    assert(nested && (nested->record == subcontext.Present()) && (nested->context == &subcontext) && (nested->depth == 1));
+
+    // An undone record is still on the stack...
+    mgr.context.Undo();
+    assert(mgr.context.Find(mergeId) && mgr.context.Find(nestedId));
+
+    // ...until a new push drops it, together with its subrecords.
+    mgr.SetObject("qux", { 3 });
+    assert(!mgr.context.Find(mergeId) && !mgr.context.Find(nestedId));
+    assert(mgr.context.Find(mgr.context.Present()->GetId())->index == 3);
+}
+
+void HistoryShowcase_Tracing()
+{
+#if HISTORY_TRACING
+    MergingManager mgr;
+    mgr.SetObject("foo", { 1 });
+    mgr.SetObject("bar", { 2 });
+
+    HistoryTrace::Start(256);
+    mgr.MergeObjects({ "foo", "bar" }, "baz");
+    mgr.context.Undo();
+    HistoryTrace::Stop();
+
+    // Nested records and HISTORY_SAVE show up as slices inside the merge, the Undo() call wraps its delegates.
+    const std::string json = HistoryTrace::ExportChromeJson();
+    assert(json.find("{\"name\":\"MergeObjects\",\"cat\":\"do\",\"ph\":\"B\"") != std::string::npos);
+    assert(json.find("{\"name\":\"RemoveObject\",\"cat\":\"do\",\"ph\":\"B\"") != std::string::npos);
+    assert(json.find("\"cat\":\"save\",\"ph\":\"B\"") != std::string::npos);
+    assert(json.find("{\"name\":\"Undo\",\"cat\":\"undo\",\"ph\":\"E\"") != std::string::npos);
+
+    // Every slice is closed.
+    size_t begins = 0;
+    size_t ends = 0;
+    for (size_t pos = json.find("\"ph\":\""); pos != std::string::npos; pos = json.find("\"ph\":\"", pos + 1))
+        (json[pos + 6] == 'B' ? begins : ends)++;
+
+    assert((begins == ends) && (begins + ends == HistoryTrace::GetEventCount()));
+
+    // Not recording anymore.
+    mgr.context.Redo();
+    assert(HistoryTrace::ExportChromeJson() == json);
+#endif
+}
+
+/// 
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+bool CheckedManager::AddChecked(const std::string& key, int value)
+{
+    HISTORY_PUSH(AddChecked, key, value);
+    if (value < 0)
+    {
+        // Nothing changed yet - leave no record behind.
+        HISTORY_ABORT_PUSH();
+        return false;
+    }
+
+    objects[key] = value;
+    return true;
+}
+
+bool CheckedManager::AddChecked_Undo(const std::string& key, int /*value*/)
+{
+    HISTORY_POP();
+    objects.erase(key);
+    return true;
+}
+
+void HistoryShowcase_ChangeFeed()
+{
+    CheckedManager mgr;
+    std::vector<std::vector<HistoryChange>> batches;
+    const size_t subscription = mgr.context.Subscribe([&batches](const std::vector<HistoryChange>& changes) { batches.push_back(changes); });
+
+    // One batch per operation.
+    mgr.AddChecked("foo", 1);
+    mgr.AddChecked("bar", 2);
+    mgr.context.Undo();
+    assert(batches.size() == 3);
+    assert((batches[0].size() == 1) && (batches[0][0].kind == HistoryChangeKind::Pushed) && (batches[0][0].first == 1) && (batches[0][0].presentIdx == 1));
+    assert((batches[2].size() == 1) && (batches[2][0].kind == HistoryChangeKind::Undone) && (batches[2][0].first == 2) && (batches[2][0].presentIdx == 1));
+    assert(batches[2][0].id == batches[1][0].id);
+
+    // Pushing over an Undo drops the Redo first.
+    mgr.AddChecked("baz", 3);
+    assert((batches.size() == 4) && (batches[3].size() == 2));
+    assert((batches[3][0].kind == HistoryChangeKind::Truncated) && (batches[3][0].first == 2) && (batches[3][0].last == 2));
+    assert((batches[3][1].kind == HistoryChangeKind::Pushed) && (batches[3][1].presentIdx == 2));
+
+    // An aborted push is never reported - only the Redo it dropped.
+    mgr.context.Undo();
+    assert(!mgr.AddChecked("qux", -1));
+    assert((batches.size() == 6) && (batches[5].size() == 1) && (batches[5][0].kind == HistoryChangeKind::Truncated) && (batches[5][0].presentIdx == 1));
+    assert(!mgr.AddChecked("qux", -1) && (batches.size() == 6));
+
+    // A batch scope merges many operations into one delivery at its end.
+    {
+        HistoryChangeBatch batch(mgr.context);
+        mgr.AddChecked("baz", 3);
+        mgr.context.Undo();
+        mgr.context.Undo();
+        assert(batches.size() == 6);
+    }
+    assert((batches.size() == 7) && (batches[6].size() == 3) && (batches[6][0].kind == HistoryChangeKind::Pushed));
+    assert((batches[6][2].kind == HistoryChangeKind::Undone) && (batches[6][2].presentIdx == 0));
+
+    mgr.context.Unsubscribe(subscription);
+    mgr.context.Redo();
+    assert(batches.size() == 7);
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+bool MementoManager::RemoveObject(const std::string& key)
+{
+    HISTORY_PUSH_MEMENTO(RemoveObject, RemoveMemento, key);
+
+    // Lives inline in the record - no key string, no std::any.
+    HISTORY_MEMENTO(RemoveMemento).oldValue = objects[key];
+
+    objects.erase(key);
+    return true;
+}
+
+bool MementoManager::RemoveObject_Undo(const std::string& key)
+{
+    HISTORY_POP();
+
+    AddObject(key, HISTORY_MEMENTO(RemoveMemento).oldValue);
+    return true;
+}
+
+void HistoryShowcase_TypedMementos()
+{
+    MementoManager mgr;
+    mgr.AddObject("foo", 11);
+    mgr.RemoveObject("foo");
+
+    assert(mgr.objects.size() == 0);
+    History::GetContext()->Undo();
+    assert(mgr.objects.size() == 1 && mgr.objects["foo"] == 11);
+    History::GetContext()->Redo();
+    assert(mgr.objects.size() == 0);
+    History::GetContext()->Undo();
+    assert(mgr.objects.size() == 1 && mgr.objects["foo"] == 11);
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+bool ContainerManager::SetObject(const std::string& key, const std::set<int>& values)
+{
+    // Records the key, the values and the overwritten values, if any.
+    return objects.Set(key, values);
+}
+
+bool ContainerManager::MergeObjects(const std::set<std::string>& keys, const std::string& newKey)
+{
+    HISTORY_PUSH_COMPOUND(MergeObjects, keys, newKey);
+
+    std::set<int> merged;
+    for (auto&& key : keys)
+    {
+        if (objects.Contains(key))
+            merged.insert(objects.At(key).begin(), objects.At(key).end());
+    }
+
+    // Each erasure records its key and values only.
+    for (auto&& key : keys)
+        objects.Erase(key);
+
+    objects.Set(newKey, merged);
+    return true;
+}
+
+void HistoryShowcase_Containers()
+{
+    ContainerManager mgr;
+    mgr.SetObject("foo", { 11, 23, 49 });
+    mgr.SetObject("bar", { 7, 8, 23 });
+    mgr.MergeObjects({ "foo", "bar" }, "foobar");
+
+    assert((mgr.objects.GetSize() == 1) && (mgr.objects.At("foobar") == std::set<int>{7, 8, 11, 23, 49}));
+    History::GetContext()->Undo();
+    assert((mgr.objects.GetSize() == 2) && (mgr.objects.At("foo") == std::set<int>{11, 23, 49}) && (mgr.objects.At("bar") == std::set<int>{7, 8, 23}));
+    History::GetContext()->Redo();
+    assert((mgr.objects.GetSize() == 1) && (mgr.objects.At("foobar") == std::set<int>{7, 8, 11, 23, 49}));
+
+    // Overwrites record the old value.
+    mgr.SetObject("foobar", { 1 });
+    History::GetContext()->Undo();
+    assert(mgr.objects.At("foobar").size() == 5);
+
+    HistoryVector<int> items;
+    items.PushBack(1);
+    items.PushBack(2);
+    items.Insert(0, 0);
+    items.Set(2, 20);
+    items.Erase(1);
+    assert((items.Get() == std::vector<int>{0, 20}));
+    for (int i = 0; i < 5; ++i)
+        History::GetContext()->Undo();
+    assert(items.IsEmpty());
+    for (int i = 0; i < 5; ++i)
+        History::GetContext()->Redo();
+    assert((items.Get() == std::vector<int>{0, 20}));
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+bool PersistentManager::SetObject(const std::string& key, int value)
+{
+    HISTORY_PUSH(SetObject, key, value);
+
+    // O(1), shares all nodes with objects.
+    auto hOldObjects = objects;
+    HISTORY_SAVE(hOldObjects);
+
+    objects.Set(key, value);
+    return true;
+}
+
+bool PersistentManager::SetObject_Undo(const std::string& /*key*/, int /*value*/)
+{
+    HISTORY_POP();
+
+    decltype(objects) hOldObjects;
+    HISTORY_LOAD(hOldObjects);
+    objects = hOldObjects;
+    return true;
+}
+
+bool PersistentManager::RemoveBelow(int minValue)
+{
+    HISTORY_PUSH(RemoveBelow, minValue);
+
+    auto hOldObjects = objects;
+    HISTORY_SAVE(hOldObjects);
+
+    for (auto&& [key, value] : hOldObjects)
+    {
+        if (value < minValue)
+            objects.Erase(key);
+    }
+
+    return true;
+}
+
+bool PersistentManager::RemoveBelow_Undo(int /*unused*/)
+{
+    HISTORY_POP();
+
+    decltype(objects) hOldObjects;
+    HISTORY_LOAD(hOldObjects);
+    objects = hOldObjects;
+    return true;
+}
+
+void HistoryShowcase_PersistentSnapshots()
+{
+    PersistentManager mgr;
+    for (int i = 0; i < 100; ++i)
+        mgr.SetObject(std::to_string(i), i);
+
+    mgr.RemoveBelow(90);
+    assert((mgr.objects.GetSize() == 10) && !mgr.objects.Contains("42"));
+    History::GetContext()->Undo();
+    assert((mgr.objects.GetSize() == 100) && (mgr.objects.At("42") == 42));
+    History::GetContext()->Redo();
+    assert(mgr.objects.GetSize() == 10);
+
+    for (int i = 0; i < 101; ++i)
+        History::GetContext()->Undo();
+    assert(mgr.objects.IsEmpty());
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+bool CanvasManager::FillRect(int x, int y, int width, int height, uint32_t color)
+{
+    HISTORY_PUSH(FillRect, x, y, width, height, color);
+
+    // Snapshot now, diffed against the result once FillRect returns.
+    HISTORY_SAVE_DIFF(pixels.data(), pixels.size() * sizeof(uint32_t));
+
+    for (int row = y; row < y + height; ++row)
+        std::fill(pixels.begin() + row * Width + x, pixels.begin() + row * Width + x + width, color);
+
+    return true;
+}
+
+bool CanvasManager::FillRect_Undo(int /*x*/, int /*y*/, int /*width*/, int /*height*/, uint32_t /*color*/)
+{
+    HISTORY_POP();
+
+    HISTORY_LOAD_DIFF(pixels.data());
+    return true;
+}
+
+bool CanvasManager::FillRectPages(int x, int y, int width, int height, uint32_t color)
+{
+    HISTORY_PUSH(FillRectPages, x, y, width, height, color);
+
+    // Write-protected until FillRectPages returns, each page is copied on its first write.
+    HISTORY_SAVE_PAGES(pixels.data(), pixels.size() * sizeof(uint32_t));
+
+    for (int row = y; row < y + height; ++row)
+        std::fill(pixels.begin() + row * Width + x, pixels.begin() + row * Width + x + width, color);
+
+    return true;
+}
+
+bool CanvasManager::FillRectPages_Undo(int /*x*/, int /*y*/, int /*width*/, int /*height*/, uint32_t /*color*/)
+{
+    HISTORY_POP();
+
+    HISTORY_LOAD_DIFF(pixels.data());
+    return true;
+}
+
+bool CanvasManager::FramePages(int x, int y, int width, int height, uint32_t fill, uint32_t border)
+{
+    HISTORY_PUSH(FramePages, x, y, width, height, fill, border);
+    HISTORY_SAVE_PAGES(pixels.data(), pixels.size() * sizeof(uint32_t));
+
+    for (int row = y; row < y + height; ++row)
+        std::fill(pixels.begin() + row * Width + x, pixels.begin() + row * Width + x + width, fill);
+
+    // The pages are tracked by this call already: the nested ones fall back to HISTORY_SAVE_DIFF.
+    FillRectPages(x, y, width, 1, border);
+    FillRectPages(x, y + height - 1, width, 1, border);
+    return true;
+}
+
+bool CanvasManager::FramePages_Undo(int x, int y, int width, int height, uint32_t /*fill*/, uint32_t border)
+{
+    HISTORY_POP();
+
+    FillRectPages_Undo(x, y + height - 1, width, 1, border);
+    FillRectPages_Undo(x, y, width, 1, border);
+    HISTORY_LOAD_DIFF(pixels.data());
+    return true;
+}
+
+void HistoryShowcase_BufferDiffs()
+{
+    CanvasManager mgr;
+    mgr.FillRect(10, 10, 100, 20, 0xFF0000FF);
+    mgr.FillRect(50, 15, 20, 100, 0x00FF00FF);
+
+    assert(mgr.pixels[15 * CanvasManager::Width + 60] == 0x00FF00FF);
+    History::GetContext()->Undo();
+    assert((mgr.pixels[15 * CanvasManager::Width + 60] == 0xFF0000FF) && (mgr.pixels[100 * CanvasManager::Width + 60] == 0));
+    History::GetContext()->Undo();
+    assert(std::all_of(mgr.pixels.begin(), mgr.pixels.end(), [](uint32_t pixel) { return pixel == 0; }));
+    History::GetContext()->Redo();
+    History::GetContext()->Redo();
+    assert((mgr.pixels[15 * CanvasManager::Width + 60] == 0x00FF00FF) && (mgr.pixels[100 * CanvasManager::Width + 60] == 0x00FF00FF));
+}
+
+void HistoryShowcase_PageTracking()
+{
+    CanvasManager mgr;
+    mgr.FillRectPages(10, 10, 100, 20, 0xFF0000FF);
+    mgr.FillRectPages(50, 15, 20, 400, 0x00FF00FF);
+    mgr.FillRect(0, 0, 5, 5, 0x0000FFFF);
+
+    // Writes after the push run unprotected.
+    mgr.pixels.back() = 1;
+    mgr.pixels.back() = 0;
+
+    assert(mgr.pixels[300 * CanvasManager::Width + 60] == 0x00FF00FF);
+    History::GetContext()->Undo();
+    History::GetContext()->Undo();
+    assert((mgr.pixels[15 * CanvasManager::Width + 60] == 0xFF0000FF) && (mgr.pixels[300 * CanvasManager::Width + 60] == 0));
+    History::GetContext()->Undo();
+    assert(std::all_of(mgr.pixels.begin(), mgr.pixels.end(), [](uint32_t pixel) { return pixel == 0; }));
+    History::GetContext()->Redo();
+    History::GetContext()->Redo();
+    History::GetContext()->Redo();
+    assert((mgr.pixels[15 * CanvasManager::Width + 60] == 0x00FF00FF) && (mgr.pixels[300 * CanvasManager::Width + 60] == 0x00FF00FF) && (mgr.pixels[0] == 0x0000FFFF));
+
+    // Nested saves of the same pages.
+    CanvasManager framed;
+    const auto at = [&framed](int x, int y) { return framed.pixels[y * CanvasManager::Width + x]; };
+    framed.FramePages(20, 20, 200, 300, 0x11111111, 0x22222222);
+    assert((at(100, 20) == 0x22222222) && (at(100, 319) == 0x22222222) && (at(100, 100) == 0x11111111));
+    History::GetContext()->Undo();
+    assert(std::all_of(framed.pixels.begin(), framed.pixels.end(), [](uint32_t pixel) { return pixel == 0; }));
+    History::GetContext()->Redo();
+    assert((at(100, 20) == 0x22222222) && (at(100, 319) == 0x22222222) && (at(100, 100) == 0x11111111));
+}
+
+///
+/// /////////////////////////////////////////////////////////////////////////////////
+///
+
+int TreeManager::AddNode(int parent)
+{
+    const int node = int(children.size());
+    children.emplace_back();
+    alive.push_back(true);
+    if (parent >= 0)
+        children[parent].push_back(node);
+
+    return node;
+}
+
+bool TreeManager::DeleteSubtree(int node)
+{
+    HISTORY_PUSH_COMPOUND(DeleteSubtree, node);
+
+    for (int child : children[node])
+        DeleteSubtree(child);
+
+    RemoveNode(node);
+    return true;
+}
+
+bool TreeManager::RemoveNode(int node)
+{
+    HISTORY_PUSH(RemoveNode, node);
+    alive[node] = false;
+    return true;
+}
+
+bool TreeManager::RemoveNode_Undo(int node)
+{
+    HISTORY_POP();
+    alive[node] = true;
+    return true;
+}
+
+void HistoryShowcase_DeepNesting()
+{
+    // A chain 2000 levels deep, with a leaf hanging off every level.
+    constexpr int Depth = 2000;
+    TreeManager mgr;
+    int node = mgr.AddNode(-1);
+    for (int i = 1; i < Depth; ++i)
+    {
+        mgr.AddNode(node);
+        node = mgr.AddNode(node);
+    }
+
+    mgr.DeleteSubtree(0);
+    assert(std::none_of(mgr.alive.begin(), mgr.alive.end(), [](bool alive) { return alive; }));
+
+    // Walks keep their position on the heap: count everything, find the deepest record.
+    size_t records = 0;
+    int deepest = 0;
+    mgr.context.Visit([&](const HistoryVisit& visit)
+    {
+        ++records;
+        deepest = std::max(deepest, visit.depth);
+        return HistoryVisitResult::Descend;
+    });
+    assert((records == 2 * (2 * Depth - 1)) && (deepest == Depth));
+
+    // Stop early: only the top record.
+    records = 0;
+    assert(!mgr.context.Visit([&](const HistoryVisit&) { ++records; return HistoryVisitResult::Stop; }) && (records == 1));
+
+    const HistoryMemoryUsage usage = mgr.context.GetMemoryUsage();
+    assert((usage.records == 2 * (2 * Depth - 1)) && (usage.recordBytes >= usage.records * sizeof(History)) && (usage.indexBytes > 0));
+
+    HistoryDumpOptions options;
+    options.maxDepth = 1;
+    std::string dump;
+    mgr.context.Dump([&dump](std::string_view line) { dump += line; }, options);
+    assert(dump == "DeleteSubtree <<<\n\tRemoveNode <<<\n\tDeleteSubtree\n\tDeleteSubtree\n");
+
+    // Compound records unwind / replay iteratively too.
+    mgr.context.Undo();
+    assert(std::all_of(mgr.alive.begin(), mgr.alive.end(), [](bool alive) { return alive; }));
+    mgr.context.Redo();
+    assert(std::none_of(mgr.alive.begin(), mgr.alive.end(), [](bool alive) { return alive; }));
+    assert(mgr.context.CheckInvariants());
+}
+
+// Define HISTORY_SHOWCASE_NO_MAIN to link the managers into another executable, e.g. Benchmark.cpp.
+#ifndef HISTORY_SHOWCASE_NO_MAIN
 int main()
 {
     HistoryShowcase_Basics();
     HistoryShowcase_InlineParams();
     HistoryShowcase_UserParams();
     HistoryShowcase_Advanced();
+    HistoryShowcase_BackgroundJobs();
+    HistoryShowcase_ReadSnapshots();
+    HistoryShowcase_Async();
+    HistoryShowcase_Compound();
+    HistoryShowcase_FindById();
+    HistoryShowcase_Tracing();
+    HistoryShowcase_ChangeFeed();
+    HistoryShowcase_TypedMementos();
+    HistoryShowcase_Containers();
+    HistoryShowcase_PersistentSnapshots();
+    HistoryShowcase_BufferDiffs();
+    HistoryShowcase_PageTracking();
+    HistoryShowcase_DeepNesting();
     return 0;
 }
+#endif
@@ -2,11 +2,26 @@
 #include <vector>
 #include <map>
 #include <set>
+#include "HistoryContainers.h"
+#include "HistoryPersistent.h"
 
 void HistoryShowcase_Basics();
 void HistoryShowcase_InlineParams();
 void HistoryShowcase_UserParams();
 void HistoryShowcase_Advanced();
+void HistoryShowcase_BackgroundJobs();
+void HistoryShowcase_ReadSnapshots();
+void HistoryShowcase_Async();
+void HistoryShowcase_Compound();
+void HistoryShowcase_FindById();
+void HistoryShowcase_Tracing();
+void HistoryShowcase_ChangeFeed();
+void HistoryShowcase_TypedMementos();
+void HistoryShowcase_Containers();
+void HistoryShowcase_PersistentSnapshots();
+void HistoryShowcase_BufferDiffs();
+void HistoryShowcase_PageTracking();
+void HistoryShowcase_DeepNesting();
 
 struct ManagerBase
 {
@@ -36,6 +51,13 @@ struct MapWithRemoveManager : MapManager
     bool RemoveObject_Undo(const std::string& key);
 };
 
+// Rejects negative values after pushing, dropping the record again with HISTORY_ABORT_PUSH.
+struct CheckedManager : MapManager
+{
+    bool AddChecked(const std::string& key, int value);
+    bool AddChecked_Undo(const std::string& key, int value);
+};
+
 struct MergingManager : ManagerBase
 {
     std::map<std::string, std::set<int>> objects;
@@ -48,4 +70,77 @@ struct MergingManager : ManagerBase
 
     bool MergeObjects(const std::set<std::string>& keys, const std::string& newKey);
     bool MergeObjects_Undo(const std::set<std::string>& keys, const std::string& newKey);
-};
\ No newline at end of file
+};
+
+struct CompoundManager : MergingManager
+{
+    bool MergeAll(const std::set<std::string>& keys, const std::string& newKey);
+};
+
+// MapWithRemoveManager with a typed memento instead of HISTORY_SAVE / HISTORY_LOAD.
+struct MementoManager : MapManager
+{
+    struct RemoveMemento
+    {
+        int oldValue;
+    };
+
+    bool RemoveObject(const std::string& key);
+    bool RemoveObject_Undo(const std::string& key);
+};
+
+// MergingManager on HistoryMap: the map records its own changes, only the merge is written by hand.
+struct ContainerManager : ManagerBase
+{
+    HistoryMap<std::string, std::set<int>> objects;
+
+    bool SetObject(const std::string& key, const std::set<int>& values = {});
+    bool MergeObjects(const std::set<std::string>& keys, const std::string& newKey);
+};
+
+// Saves its whole map per operation. Persistent, so HISTORY_SAVE only copies a root pointer.
+struct PersistentManager : ManagerBase
+{
+    HistoryPersistentMap<std::string, int> objects;
+
+    bool SetObject(const std::string& key, int value);
+    bool SetObject_Undo(const std::string& key, int value);
+
+    bool RemoveBelow(int minValue);
+    bool RemoveBelow_Undo(int minValue);
+};
+
+// Draws into a flat pixel buffer. Each stroke keeps only the blocks it changed, not the whole buffer.
+struct CanvasManager : ManagerBase
+{
+    static constexpr int Width = 512;
+    static constexpr int Height = 512;
+
+    std::vector<uint32_t> pixels = std::vector<uint32_t>(Width * Height);
+
+    bool FillRect(int x, int y, int width, int height, uint32_t color);
+    bool FillRect_Undo(int x, int y, int width, int height, uint32_t color);
+
+    // FillRect catching the written pages instead of snapshotting the canvas.
+    bool FillRectPages(int x, int y, int width, int height, uint32_t color);
+    bool FillRectPages_Undo(int x, int y, int width, int height, uint32_t color);
+
+    // Fills a rect, then outlines its top and bottom with nested FillRectPages: both levels track the same pages.
+    bool FramePages(int x, int y, int width, int height, uint32_t fill, uint32_t border);
+    bool FramePages_Undo(int x, int y, int width, int height, uint32_t fill, uint32_t border);
+};
+
+// Tree of nodes by index. DeleteSubtree() recurses, nesting one compound record per tree level.
+struct TreeManager : ManagerBase
+{
+    std::vector<std::vector<int>> children;
+    std::vector<bool> alive;
+
+    // Not recorded. @returns the new node
+    int AddNode(int parent);
+
+    bool DeleteSubtree(int node);
+
+    bool RemoveNode(int node);
+    bool RemoveNode_Undo(int node);
+};